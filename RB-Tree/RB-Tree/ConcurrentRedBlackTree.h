@@ -0,0 +1,187 @@
+/*
+Concurrent Red Black Tree
+thread safe variant of the red black tree with lock free lookups
+released under GNU GPL licence
+*/
+#ifndef CONCURRENT_RED_BLACK_TREE_H
+#define CONCURRENT_RED_BLACK_TREE_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include "RedBlackTree.h"
+
+using namespace std;
+
+//counts the readers inside one version of the tree, striped over cache lines so readers on different cores do not share one
+class ReadIndicator
+{
+private:
+	static const size_t Stripes = 64;
+	struct alignas(64) Counter
+	{
+		atomic<long> readers;
+	};
+	Counter counters[Stripes];
+
+	static size_t Stripe()
+	{
+		static thread_local size_t stripe = hash<thread::id>()(this_thread::get_id()) % Stripes;
+		return stripe;
+	}
+public:
+	ReadIndicator()
+	{
+		for (size_t i = 0; i < Stripes; i++) this->counters[i].readers.store(0);
+	}
+	void Arrive()
+	{
+		this->counters[Stripe()].readers.fetch_add(1);
+	}
+	void Depart()
+	{
+		this->counters[Stripe()].readers.fetch_sub(1);
+	}
+	bool IsEmpty()
+	{
+		for (size_t i = 0; i < Stripes; i++) if (this->counters[i].readers.load() != 0) return false;
+		return true;
+	}
+};
+
+//left-right concurrency (Correia and Ramalhete): two copies of the tree, readers always get one nobody writes to
+//lookups take no lock and never wait, they only mark themselves in a read indicator
+//writers are serialized: a change goes to the copy readers left, readers are switched over to it,
+//the writer waits until the last reader of the old copy is gone and repeats the change there
+//so every value is stored twice and every change is applied twice
+template <class T, class Compare = less<T>, class Alloc = allocator<T>, class Augment = NoAugment> class ConcurrentRedBlackTree
+{
+public:
+	typedef RedBlackTree<T, Compare, Alloc, Augment> Tree;
+private:
+	Tree leftTree, rightTree;
+	//the copy readers are sent to
+	atomic<int> readIndex;
+	//the read indicator new readers arrive at
+	atomic<int> versionIndex;
+	ReadIndicator readIndicators[2];
+	mutex writeMutex;
+
+	ConcurrentRedBlackTree(const ConcurrentRedBlackTree&) = delete;
+	ConcurrentRedBlackTree& operator=(const ConcurrentRedBlackTree&) = delete;
+
+	Tree& GetTree(int index)
+	{
+		return index == 0 ? this->leftTree : this->rightTree;
+	}
+
+	//the writer half of left-right, called with the write mutex held
+	template <class Change> void Apply(Change change)
+	{
+		int readingIndex = this->readIndex.load();
+		change(this->GetTree(1 - readingIndex));
+		this->readIndex.store(1 - readingIndex);
+		//readers that arrived before the switch may still be on the old copy - flip the version and wait for both sides to drain
+		int previousVersion = this->versionIndex.load();
+		int nextVersion = 1 - previousVersion;
+		while (!this->readIndicators[nextVersion].IsEmpty()) this_thread::yield();
+		this->versionIndex.store(nextVersion);
+		while (!this->readIndicators[previousVersion].IsEmpty()) this_thread::yield();
+		change(this->GetTree(readingIndex));
+	}
+public:
+	explicit ConcurrentRedBlackTree(const Compare& compare = Compare(), const Alloc& alloc = Alloc())
+		: leftTree(compare, alloc), rightTree(compare, alloc)
+	{
+		this->readIndex.store(0);
+		this->versionIndex.store(0);
+	}
+
+	//runs a read only function on a consistent version of the tree, without taking any lock
+	//the function must not modify the tree and nodes must not be kept after it returns
+	template <class Reader> auto Read(Reader reader) -> decltype(reader(declval<Tree&>()))
+	{
+		struct Departure
+		{
+			ReadIndicator& indicator;
+			~Departure()
+			{
+				indicator.Depart();
+			}
+		};
+		ReadIndicator& indicator = this->readIndicators[this->versionIndex.load()];
+		indicator.Arrive();
+		Departure departure = { indicator };
+		return reader(this->GetTree(this->readIndex.load()));
+	}
+	bool Contains(const T& value)
+	{
+		return this->Read([&value](Tree& tree) { return tree.AccessNode(value) != NULL; });
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, bool>::type Contains(const K& key)
+	{
+		return this->Read([&key](Tree& tree) { return tree.AccessNode(key) != NULL; });
+	}
+	//copies the stored value equal to the key out, as nodes may be freed once the read is over
+	template <class K> bool Find(const K& key, T& value)
+	{
+		return this->Read([&key, &value](Tree& tree)
+		{
+			typename Tree::Node* node = tree.AccessNode(key);
+			if (node == NULL) return false;
+			value = node->GetValue();
+			return true;
+		});
+	}
+
+	//changes - every one of them is applied to both copies under the write mutex
+	//a change passed to Write has to be deterministic, as it runs once per copy
+	template <class Change> void Write(Change change)
+	{
+		lock_guard<mutex> lock(this->writeMutex);
+		this->Apply(change);
+	}
+	void InsertNode(const T& value)
+	{
+		this->Write([&value](Tree& tree) { tree.InsertNode(value); });
+	}
+	void DeleteNode(const T& value)
+	{
+		this->Write([&value](Tree& tree) { tree.DeleteNode(value); });
+	}
+	template <class InputIterator> void InsertBatch(InputIterator first, InputIterator last)
+	{
+		vector<T> batch(first, last);
+		this->Write([&batch](Tree& tree) { tree.InsertBatch(batch.begin(), batch.end()); });
+	}
+	template <class InputIterator> void DeleteBatch(InputIterator first, InputIterator last)
+	{
+		vector<T> batch(first, last);
+		this->Write([&batch](Tree& tree) { tree.DeleteBatch(batch.begin(), batch.end()); });
+	}
+	void InsertBatch(const T* values, size_t n)
+	{
+		this->InsertBatch(values, values + n);
+	}
+	void DeleteBatch(const T* values, size_t n)
+	{
+		this->DeleteBatch(values, values + n);
+	}
+	void ReleaseAll()
+	{
+		this->Write([](Tree& tree) { tree.ReleaseAll(); });
+	}
+	//relaxed balance on both copies, see RedBlackTree::SetRelaxedBalance
+	void SetRelaxedBalance(bool relaxed)
+	{
+		this->Write([relaxed](Tree& tree) { tree.SetRelaxedBalance(relaxed); });
+	}
+	//a bounded step of repairs, for a background thread between the bursts - lookups go on meanwhile
+	void Rebalance(size_t budget)
+	{
+		this->Write([budget](Tree& tree) { tree.Rebalance(budget); });
+	}
+};
+
+#endif
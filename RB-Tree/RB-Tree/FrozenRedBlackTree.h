@@ -0,0 +1,155 @@
+/*
+Frozen Red Black Tree
+read only cache friendly copy of a red black tree
+released under GNU GPL licence
+*/
+#ifndef FROZEN_RED_BLACK_TREE_H
+#define FROZEN_RED_BLACK_TREE_H
+
+#include <stdint.h>
+#include <vector>
+#include <iterator>
+#include <cstddef>
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+#include "RedBlackTree.h"
+
+using namespace std;
+
+constexpr size_t FloorPowerOfTwo(size_t x)
+{
+	return x <= 1 ? 1 : 2 * FloorPowerOfTwo(x / 2);
+}
+
+//the values of a complete binary search tree stored level by level (Eytzinger order) in one cache line aligned array
+//the children of position i are 2i and 2i + 1, so there are no links to follow and the top levels share a few cache lines
+//a lookup is a branch free descent that prefetches the line holding the descendants several levels down,
+//so the misses of consecutive levels overlap instead of being paid one after another (Khuong and Morin)
+//built by RedBlackTree::Freeze(), values must be default constructible and copyable
+template <class T, class Compare> class FrozenRedBlackTree
+{
+private:
+	static const size_t CacheLine = 64;
+	//values of one cache line - the descendants of i that far down are the ones at i * LineValues onwards
+	static const size_t LineValues = sizeof(T) >= CacheLine ? 1 : FloorPowerOfTwo(CacheLine / sizeof(T));
+
+	//position 0 is unused and sits at the start of a cache line, the values are at 1..count
+	vector<T> storage;
+	size_t first;
+	size_t count;
+	Compare compare;
+
+	T* Values()
+	{
+		return this->storage.data() + this->first;
+	}
+	const T* Values() const
+	{
+		return this->storage.data() + this->first;
+	}
+	void Allocate(size_t count)
+	{
+		this->storage.assign(count + 1 + LineValues, T());
+		uintptr_t address = (uintptr_t)this->storage.data();
+		this->first = 0;
+		while ((address + this->first * sizeof(T)) % CacheLine != 0 && this->first < LineValues) this->first++;
+		//sizes that never reach a line boundary just stay unaligned
+		if (this->first == LineValues) this->first = 0;
+		this->count = count;
+	}
+	static void Prefetch(uintptr_t address)
+	{
+#if defined(_MSC_VER)
+		_mm_prefetch((const char*)address, _MM_HINT_T0);
+#else
+		__builtin_prefetch((const void*)address);
+#endif
+	}
+	//position of the first value not less than the key, 0 if there is none
+	template <class K> size_t LowerBound(const K& key) const
+	{
+		const T* values = this->Values();
+		size_t i = 1;
+		while (i <= this->count)
+		{
+			//may point past the array - a prefetch never faults
+			Prefetch((uintptr_t)values + i * LineValues * sizeof(T));
+			i = 2 * i + (size_t)this->compare(values[i], key);
+		}
+		//the low bits of i are the turns taken: drop the right turns after the last left one, then that left turn
+		while (i & 1) i >>= 1;
+		return i >> 1;
+	}
+	template <class K> const T* Find(const K& key) const
+	{
+		size_t i = this->LowerBound(key);
+		if (i != 0 && !this->compare(key, this->Values()[i])) return this->Values() + i;
+		return NULL;
+	}
+public:
+	//values sorted by Compare without repetitions, as a tree iterates them
+	template <class ForwardIterator> FrozenRedBlackTree(ForwardIterator first, ForwardIterator last, const Compare& compare = Compare())
+		: compare(compare)
+	{
+		this->Allocate((size_t)distance(first, last));
+		if (this->count == 0) return;
+		T* values = this->Values();
+		//in-order walk of the implicit tree, starting from its leftmost position
+		size_t i = 1;
+		while (2 * i <= this->count) i = 2 * i;
+		for (; first != last; ++first)
+		{
+			values[i] = *first;
+			if (2 * i + 1 <= this->count)
+			{
+				i = 2 * i + 1;
+				while (2 * i <= this->count) i = 2 * i;
+			}
+			else
+			{
+				while (i & 1) i >>= 1;
+				i >>= 1;
+			}
+		}
+	}
+	FrozenRedBlackTree(const FrozenRedBlackTree& other) : compare(other.compare)
+	{
+		this->Allocate(other.count);
+		copy(other.Values() + 1, other.Values() + 1 + other.count, this->Values() + 1);
+	}
+	//moving keeps the buffer and with it the alignment
+	FrozenRedBlackTree(FrozenRedBlackTree&& other) : storage(move(other.storage)), first(other.first), count(other.count), compare(other.compare)
+	{
+		other.first = 0;
+		other.count = 0;
+	}
+	FrozenRedBlackTree& operator=(FrozenRedBlackTree other)
+	{
+		this->storage.swap(other.storage);
+		swap(this->first, other.first);
+		swap(this->count, other.count);
+		swap(this->compare, other.compare);
+		return *this;
+	}
+
+	size_t Size() const
+	{
+		return this->count;
+	}
+	bool IsEmpty() const
+	{
+		return this->count == 0;
+	}
+	//the stored value equal to the given one, NULL if there is none
+	const T* AccessNode(const T& value) const
+	{
+		return this->Find(value);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, const T*>::type AccessNode(const K& key) const
+	{
+		return this->Find(key);
+	}
+};
+
+#endif
@@ -0,0 +1,306 @@
+/*
+Mapped Red Black Tree
+read only red black tree image used straight from a memory mapped file
+released under GNU GPL licence
+*/
+#ifndef MAPPED_RED_BLACK_TREE_H
+#define MAPPED_RED_BLACK_TREE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include "RedBlackTree.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+//layout of an image file, every position in it is an offset from the start of the file
+//the values follow in order from the first page boundary, then comes the first value of every page
+struct MappedImageHeader
+{
+	static const uint32_t CurrentVersion = 1;
+
+	char magic[8];
+	uint32_t version;
+	uint32_t valueSize;
+	uint64_t count;
+	uint64_t valuesOffset;
+	//values per page of the values section, and where their first values are
+	uint64_t pageValues;
+	uint64_t indexOffset;
+	uint64_t indexCount;
+};
+
+//a tree saved as an image of trivially copyable values, opened by mapping the file - nothing is read or built at open,
+//the operating system pages the image in as lookups touch it
+//a lookup binary searches the small page index and then one page of values, range queries are plain scans
+//the values hold no pointers, so the same file can be mapped anywhere; it is not portable across byte orders
+template <class T, class Compare = less<T> > class MappedRedBlackTree
+{
+private:
+	static_assert(is_trivially_copyable<T>::value, "images hold trivially copyable values only");
+	static const size_t PageSize = 4096;
+
+	const char* image;
+	size_t imageSize;
+	const T* values;
+	const T* index;
+	size_t count;
+	size_t pageValues;
+	size_t indexCount;
+	Compare compare;
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#endif
+
+	MappedRedBlackTree(const MappedRedBlackTree&) = delete;
+	MappedRedBlackTree& operator=(const MappedRedBlackTree&) = delete;
+
+	static void MagicOf(char* magic)
+	{
+		memcpy(magic, "RBTIMAGE", 8);
+	}
+	static bool WritePadding(FILE* file, uint64_t& position, uint64_t alignment)
+	{
+		static const char zeros[PageSize] = { 0 };
+		size_t padding = (size_t)((alignment - position % alignment) % alignment);
+		position += padding;
+		return fwrite(zeros, 1, padding, file) == padding;
+	}
+	//replaces the file at to by the one at from in one step, readers see either the old or the new one
+	static bool MoveOver(const char* from, const char* to)
+	{
+#if defined(_WIN32)
+		return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return rename(from, to) == 0;
+#endif
+	}
+	bool Map(const char* path)
+	{
+#if defined(_WIN32)
+		this->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (this->file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(this->file, &size) || size.QuadPart < (LONGLONG)sizeof(MappedImageHeader)) return false;
+		this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (this->mapping == NULL) return false;
+		this->image = (const char*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+		this->imageSize = (size_t)size.QuadPart;
+		return this->image != NULL;
+#else
+		int file = open(path, O_RDONLY);
+		if (file < 0) return false;
+		struct stat status;
+		if (fstat(file, &status) != 0 || status.st_size < (off_t)sizeof(MappedImageHeader))
+		{
+			close(file);
+			return false;
+		}
+		void* image = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_SHARED, file, 0);
+		//the mapping keeps the file alive
+		close(file);
+		if (image == MAP_FAILED) return false;
+		this->image = (const char*)image;
+		this->imageSize = (size_t)status.st_size;
+		return true;
+#endif
+	}
+	void Unmap()
+	{
+#if defined(_WIN32)
+		if (this->image != NULL) UnmapViewOfFile(this->image);
+		if (this->mapping != NULL) CloseHandle(this->mapping);
+		if (this->file != INVALID_HANDLE_VALUE) CloseHandle(this->file);
+		this->file = INVALID_HANDLE_VALUE;
+		this->mapping = NULL;
+#else
+		if (this->image != NULL) munmap((void*)this->image, this->imageSize);
+#endif
+		this->image = NULL;
+		this->imageSize = 0;
+		this->values = NULL;
+		this->index = NULL;
+		this->count = 0;
+		this->indexCount = 0;
+	}
+	//checks that every section the header points at lies inside the file
+	bool Attach()
+	{
+		MappedImageHeader header;
+		memcpy(&header, this->image, sizeof(header));
+		char magic[8];
+		MagicOf(magic);
+		if (memcmp(header.magic, magic, 8) != 0 || header.version != MappedImageHeader::CurrentVersion) return false;
+		if (header.valueSize != sizeof(T) || header.pageValues == 0) return false;
+		if (header.valuesOffset % alignof(T) != 0 || header.indexOffset % alignof(T) != 0) return false;
+		if (header.indexCount != (header.count + header.pageValues - 1) / header.pageValues) return false;
+		if (header.valuesOffset > this->imageSize || header.count > (this->imageSize - header.valuesOffset) / sizeof(T)) return false;
+		if (header.indexOffset > this->imageSize || header.indexCount > (this->imageSize - header.indexOffset) / sizeof(T)) return false;
+		this->values = (const T*)(this->image + header.valuesOffset);
+		this->index = (const T*)(this->image + header.indexOffset);
+		this->count = (size_t)header.count;
+		this->pageValues = (size_t)header.pageValues;
+		this->indexCount = (size_t)header.indexCount;
+		return true;
+	}
+	//position of the first value not less than the key
+	template <class K> size_t LowerBound(const K& key) const
+	{
+		//the last page starting with a value not greater than the key is the only one that can hold it
+		const T* page = std::upper_bound(this->index, this->index + this->indexCount, key,
+			[this](const K& key, const T& value) { return this->compare(key, value); });
+		if (page == this->index) return 0;
+		size_t first = (size_t)(page - this->index - 1) * this->pageValues;
+		size_t last = min(first + this->pageValues, this->count);
+		return (size_t)(std::lower_bound(this->values + first, this->values + last, key,
+			[this](const T& value, const K& key) { return this->compare(value, key); }) - this->values);
+	}
+	template <class K> size_t UpperBound(const K& key) const
+	{
+		size_t position = this->LowerBound(key);
+		if (position < this->count && !this->compare(key, this->values[position])) position++;
+		return position;
+	}
+	template <class K> const T* Find(const K& key) const
+	{
+		size_t position = this->LowerBound(key);
+		if (position < this->count && !this->compare(key, this->values[position])) return this->values + position;
+		return NULL;
+	}
+public:
+	typedef const T* Iterator;
+	typedef Iterator iterator;
+	typedef Iterator const_iterator;
+	typedef T value_type;
+
+	explicit MappedRedBlackTree(const Compare& compare = Compare()) : image(NULL), imageSize(0), values(NULL), index(NULL),
+		count(0), pageValues(1), indexCount(0), compare(compare)
+	{
+#if defined(_WIN32)
+		this->file = INVALID_HANDLE_VALUE;
+		this->mapping = NULL;
+#endif
+	}
+	~MappedRedBlackTree()
+	{
+		this->Close();
+	}
+
+	//writes the values of a tree ordered by the same Compare as an image, false if the file could not be written
+	//the image is written to path + ".tmp" and renamed over path once complete, so the file of an image that is mapped
+	//somewhere is never truncated or rewritten under it (on Windows the rename fails while the old image is open)
+	template <class Tree> static bool Save(Tree& tree, const char* path)
+	{
+		string temporary = string(path) + ".tmp";
+		FILE* file = fopen(temporary.c_str(), "wb");
+		if (file == NULL) return false;
+		//the magic stays zero until the header is completed last, so a file cut short is never taken for an image
+		MappedImageHeader header;
+		memset(&header, 0, sizeof(header));
+		header.version = MappedImageHeader::CurrentVersion;
+		header.valueSize = sizeof(T);
+		header.pageValues = PageSize / sizeof(T) > 0 ? PageSize / sizeof(T) : 1;
+		header.valuesOffset = PageSize;
+		uint64_t position = sizeof(header);
+		bool written = fwrite(&header, sizeof(header), 1, file) == 1 && WritePadding(file, position, PageSize);
+		//values go out in order, the first one of every page is kept for the index
+		vector<T> index;
+		for (typename Tree::Iterator it = tree.begin(); written && it != tree.end(); ++it)
+		{
+			if (header.count % header.pageValues == 0) index.push_back(*it);
+			written = fwrite(&*it, sizeof(T), 1, file) == 1;
+			header.count++;
+		}
+		position += header.count * sizeof(T);
+		written = written && WritePadding(file, position, alignof(T));
+		header.indexOffset = position;
+		header.indexCount = index.size();
+		if (written && !index.empty()) written = fwrite(index.data(), sizeof(T), index.size(), file) == index.size();
+		MagicOf(header.magic);
+		written = written && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+		written = fclose(file) == 0 && written && MoveOver(temporary.c_str(), path);
+		if (!written) remove(temporary.c_str());
+		return written;
+	}
+	//maps an image in O(1), false if it is missing or not an image of this value type
+	bool Open(const char* path)
+	{
+		this->Close();
+		if (this->Map(path) && this->Attach()) return true;
+		this->Unmap();
+		return false;
+	}
+	void Close()
+	{
+		this->Unmap();
+	}
+	bool IsOpen() const
+	{
+		return this->image != NULL;
+	}
+	//rebuilds a mutable tree from the image in O(n), see RedBlackTree::BuildFromSorted
+	template <class Tree> void Thaw(Tree& tree) const
+	{
+		tree.BuildFromSorted(this->begin(), this->end());
+	}
+
+	size_t Size() const
+	{
+		return this->count;
+	}
+	bool IsEmpty() const
+	{
+		return this->count == 0;
+	}
+	//the stored value equal to the given one, NULL if there is none
+	const T* AccessNode(const T& value) const
+	{
+		return this->Find(value);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, const T*>::type AccessNode(const K& key) const
+	{
+		return this->Find(key);
+	}
+	//range scans run over the mapped values in order
+	Iterator begin() const
+	{
+		return this->values;
+	}
+	Iterator end() const
+	{
+		return this->values + this->count;
+	}
+	Iterator lower_bound(const T& value) const
+	{
+		return this->values + this->LowerBound(value);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, Iterator>::type lower_bound(const K& key) const
+	{
+		return this->values + this->LowerBound(key);
+	}
+	Iterator upper_bound(const T& value) const
+	{
+		return this->values + this->UpperBound(value);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, Iterator>::type upper_bound(const K& key) const
+	{
+		return this->values + this->UpperBound(key);
+	}
+};
+
+#endif
@@ -0,0 +1,173 @@
+/*
+Node Pool
+slab allocator for tree nodes
+released under GNU GPL licence
+*/
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <new>
+#include <memory>
+#include <vector>
+#include <type_traits>
+
+using namespace std;
+
+//hands out fixed size slots from contiguous chunks and keeps a free list of returned ones
+//chunks come from operator new, so a slot is aligned for anything its size is a multiple of, up to max_align_t
+class NodePool
+{
+private:
+	struct Slot
+	{
+		Slot* next;
+	};
+	vector<char*> chunks;
+	Slot* freeList;
+	size_t slotSize;
+	size_t slotsPerChunk;
+	size_t usedInLastChunk;
+
+	NodePool(const NodePool&) = delete;
+	NodePool& operator=(const NodePool&) = delete;
+public:
+	NodePool(size_t slotSize, size_t slotsPerChunk) : freeList(NULL), slotSize(slotSize), slotsPerChunk(slotsPerChunk), usedInLastChunk(slotsPerChunk)
+	{
+	}
+	~NodePool()
+	{
+		this->ReleaseAll();
+	}
+	void* Allocate()
+	{
+		//reuse deleted nodes first
+		if (this->freeList != NULL)
+		{
+			Slot* slot = this->freeList;
+			this->freeList = slot->next;
+			return slot;
+		}
+		if (this->usedInLastChunk == this->slotsPerChunk)
+		{
+			this->chunks.push_back(static_cast<char*>(::operator new(this->slotsPerChunk * this->slotSize)));
+			this->usedInLastChunk = 0;
+		}
+		return this->chunks.back() + this->slotSize * this->usedInLastChunk++;
+	}
+	void Deallocate(void* object)
+	{
+		Slot* slot = static_cast<Slot*>(object);
+		slot->next = this->freeList;
+		this->freeList = slot;
+	}
+	//frees every chunk at once - objects still living in them are not destroyed
+	void ReleaseAll()
+	{
+		for (size_t i = 0; i < this->chunks.size(); i++) ::operator delete(this->chunks[i]);
+		this->chunks.clear();
+		this->freeList = NULL;
+		this->usedInLastChunk = this->slotsPerChunk;
+	}
+	size_t SlotSize() const
+	{
+		return this->slotSize;
+	}
+	size_t ChunkCount() const
+	{
+		return this->chunks.size();
+	}
+};
+
+//the pools of an allocator and of all its copies, rebound ones included: one pool per slot size,
+//so types of the same slot size recycle each other's slots
+template <size_t NodesPerChunk> class NodePoolGroup
+{
+private:
+	vector<unique_ptr<NodePool> > pools;
+public:
+	//slots hold a free list link while unused and are padded to the alignment of the type
+	template <class T> NodePool* PoolFor()
+	{
+		static_assert(alignof(T) <= alignof(max_align_t), "the pool does not hand out over-aligned slots");
+		size_t alignment = alignof(T) > alignof(void*) ? alignof(T) : alignof(void*);
+		size_t size = sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*);
+		size = (size + alignment - 1) / alignment * alignment;
+		for (size_t i = 0; i < this->pools.size(); i++) if (this->pools[i]->SlotSize() == size) return this->pools[i].get();
+		this->pools.push_back(unique_ptr<NodePool>(new NodePool(size, NodesPerChunk)));
+		return this->pools.back().get();
+	}
+	void ReleaseAll()
+	{
+		for (size_t i = 0; i < this->pools.size(); i++) this->pools[i]->ReleaseAll();
+	}
+};
+
+//std::allocator compatible front end of NodePool
+//copies and rebound copies share the pools and compare equal, so each can free what the others allocated
+//a default constructed allocator starts new pools, like every tree constructed without one
+template <class T, size_t NodesPerChunk = 4096> class PoolAllocator
+{
+private:
+	template <class U, size_t N> friend class PoolAllocator;
+	shared_ptr<NodePoolGroup<NodesPerChunk> > group;
+	//the pool of T's slot size, looked up once
+	NodePool* pool;
+public:
+	typedef T value_type;
+	template <class U> struct rebind
+	{
+		typedef PoolAllocator<U, NodesPerChunk> other;
+	};
+
+	PoolAllocator() : group(make_shared<NodePoolGroup<NodesPerChunk> >())
+	{
+		this->pool = this->group->template PoolFor<T>();
+	}
+	template <class U> PoolAllocator(const PoolAllocator<U, NodesPerChunk>& other) : group(other.group)
+	{
+		this->pool = this->group->template PoolFor<T>();
+	}
+	T* allocate(size_t n)
+	{
+		if (n == 1) return static_cast<T*>(this->pool->Allocate());
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+	void deallocate(T* object, size_t n)
+	{
+		if (n == 1) this->pool->Deallocate(object);
+		else ::operator delete(object);
+	}
+	//frees the chunks of every pool of the group, whatever allocated from them
+	void ReleaseAll()
+	{
+		this->group->ReleaseAll();
+	}
+	//how many allocators share the pools - a tree drops the chunks at once only while it is the one user
+	long UseCount() const
+	{
+		return this->group.use_count();
+	}
+	size_t ChunkCount() const
+	{
+		return this->pool->ChunkCount();
+	}
+	template <class U> bool operator==(const PoolAllocator<U, NodesPerChunk>& other) const
+	{
+		return this->group == other.group;
+	}
+	template <class U> bool operator!=(const PoolAllocator<U, NodesPerChunk>& other) const
+	{
+		return this->group != other.group;
+	}
+};
+
+//allocators whose whole storage can be dropped in one call
+template <class Alloc> struct IsReleasableAllocator : false_type
+{
+};
+template <class T, size_t NodesPerChunk> struct IsReleasableAllocator<PoolAllocator<T, NodesPerChunk> > : true_type
+{
+};
+
+#endif
@@ -0,0 +1,373 @@
+/*
+Persistent Red Black Tree
+path copying variant of the red black tree for snapshots
+released under GNU GPL licence
+*/
+#ifndef PERSISTENT_RED_BLACK_TREE_H
+#define PERSISTENT_RED_BLACK_TREE_H
+
+#include <memory>
+#include <vector>
+#include <iterator>
+#include <cstddef>
+#include <utility>
+#include "RedBlackTree.h"
+
+using namespace std;
+
+//immutable once built: no parent pointer, so a node can be shared by any number of versions
+//children are reference counted and a node is freed with the last version using it
+template <class T> class PersistentRBNode
+{
+private:
+	template <class, class, class> friend class PersistentRedBlackTree;
+	typedef shared_ptr<const PersistentRBNode> Pointer;
+	bool red;
+	Pointer left, right;
+	T value;
+public:
+	PersistentRBNode(bool red, const Pointer& left, const T& value, const Pointer& right) : red(red), left(left), right(right), value(value)
+	{
+	}
+	bool IsRed() const
+	{
+		return this->red;
+	}
+	const T& GetValue() const
+	{
+		return this->value;
+	}
+	const PersistentRBNode* GetLeft() const
+	{
+		return this->left.get();
+	}
+	const PersistentRBNode* GetRight() const
+	{
+		return this->right.get();
+	}
+};
+
+//a handle to one version of the tree: copying it is an O(1) snapshot
+//InsertNode and DeleteNode copy only the O(log n) nodes on the root path and return the new version,
+//every other subtree is shared with the old one, which stays valid and unchanged
+//the root is read and written atomically, so one thread may publish new versions into a handle while others copy it
+//balancing follows Okasaki for insertion and Kahrs for deletion
+template <class T, class Compare = less<T>, class Alloc = allocator<T> > class PersistentRedBlackTree
+{
+public:
+	typedef PersistentRBNode<T> Node;
+	//a found node together with its version, so it stays valid whatever is published into the tree meanwhile
+	typedef shared_ptr<const Node> NodeHandle;
+private:
+	typedef shared_ptr<const Node> NodePointer;
+	typedef typename allocator_traits<Alloc>::template rebind_alloc<Node> NodeAllocator;
+
+	NodePointer root;
+	Compare compare;
+	NodeAllocator nodeAllocator;
+
+	PersistentRedBlackTree(const NodePointer& root, const Compare& compare, const NodeAllocator& nodeAllocator)
+		: root(root), compare(compare), nodeAllocator(nodeAllocator)
+	{
+	}
+	PersistentRedBlackTree WithRoot(const NodePointer& root) const
+	{
+		return PersistentRedBlackTree(root, this->compare, this->nodeAllocator);
+	}
+
+	//every new node comes from here - nothing is ever changed after it is built
+	NodePointer Red(const NodePointer& left, const T& value, const NodePointer& right) const
+	{
+		return allocate_shared<Node>(this->nodeAllocator, true, left, value, right);
+	}
+	NodePointer Black(const NodePointer& left, const T& value, const NodePointer& right) const
+	{
+		return allocate_shared<Node>(this->nodeAllocator, false, left, value, right);
+	}
+	static bool IsRed(const NodePointer& node)
+	{
+		return node && node->red;
+	}
+	static bool IsBlack(const NodePointer& node)
+	{
+		return node && !node->red;
+	}
+	NodePointer MakeRed(const NodePointer& node) const
+	{
+		if (!node || node->red) return node;
+		return this->Red(node->left, node->value, node->right);
+	}
+	NodePointer MakeBlack(const NodePointer& node) const
+	{
+		if (!node || !node->red) return node;
+		return this->Black(node->left, node->value, node->right);
+	}
+
+	//a black node over a red child with a red child becomes a red node over two black ones
+	NodePointer BalanceLeft(const NodePointer& left, const T& value, const NodePointer& right) const
+	{
+		if (IsRed(left) && IsRed(left->left))
+		{
+			return this->Red(this->Black(left->left->left, left->left->value, left->left->right), left->value,
+				this->Black(left->right, value, right));
+		}
+		if (IsRed(left) && IsRed(left->right))
+		{
+			return this->Red(this->Black(left->left, left->value, left->right->left), left->right->value,
+				this->Black(left->right->right, value, right));
+		}
+		return this->Black(left, value, right);
+	}
+	NodePointer BalanceRight(const NodePointer& left, const T& value, const NodePointer& right) const
+	{
+		if (IsRed(right) && IsRed(right->left))
+		{
+			return this->Red(this->Black(left, value, right->left->left), right->left->value,
+				this->Black(right->left->right, right->value, right->right));
+		}
+		if (IsRed(right) && IsRed(right->right))
+		{
+			return this->Red(this->Black(left, value, right->left), right->value,
+				this->Black(right->right->left, right->right->value, right->right->right));
+		}
+		return this->Black(left, value, right);
+	}
+	//the same checking the outer grandchild first, as deletion needs it
+	NodePointer BalanceRightOuter(const NodePointer& left, const T& value, const NodePointer& right) const
+	{
+		if (IsRed(right) && IsRed(right->right))
+		{
+			return this->Red(this->Black(left, value, right->left), right->value,
+				this->Black(right->right->left, right->right->value, right->right->right));
+		}
+		if (IsRed(right) && IsRed(right->left))
+		{
+			return this->Red(this->Black(left, value, right->left->left), right->left->value,
+				this->Black(right->left->right, right->value, right->right));
+		}
+		return this->Black(left, value, right);
+	}
+
+	//insertion (inner implementation) - the key is known to be missing
+	NodePointer Insert(const NodePointer& node, const T& value) const
+	{
+		if (!node) return this->Red(NodePointer(), value, NodePointer());
+		if (this->compare(value, node->value))
+		{
+			if (node->red) return this->Red(this->Insert(node->left, value), node->value, node->right);
+			return this->BalanceLeft(this->Insert(node->left, value), node->value, node->right);
+		}
+		if (node->red) return this->Red(node->left, node->value, this->Insert(node->right, value));
+		return this->BalanceRight(node->left, node->value, this->Insert(node->right, value));
+	}
+
+	//deletion (inner implementation) - the key is known to be present
+	//the side a black node was removed from is one black short, these two rebalance it
+	NodePointer ShortLeft(const NodePointer& left, const T& value, const NodePointer& right) const
+	{
+		if (IsRed(left)) return this->Red(this->Black(left->left, left->value, left->right), value, right);
+		if (IsBlack(right)) return this->BalanceRightOuter(left, value, this->Red(right->left, right->value, right->right));
+		if (IsRed(right) && IsBlack(right->left))
+		{
+			return this->Red(this->Black(left, value, right->left->left), right->left->value,
+				this->BalanceRightOuter(right->left->right, right->value, this->MakeRed(right->right)));
+		}
+		return this->Red(left, value, right);
+	}
+	NodePointer ShortRight(const NodePointer& left, const T& value, const NodePointer& right) const
+	{
+		if (IsRed(right)) return this->Red(left, value, this->Black(right->left, right->value, right->right));
+		if (IsBlack(left)) return this->BalanceLeft(this->Red(left->left, left->value, left->right), value, right);
+		if (IsRed(left) && IsBlack(left->right))
+		{
+			return this->Red(this->BalanceLeft(this->MakeRed(left->left), left->value, left->right->left), left->right->value,
+				this->Black(left->right->right, value, right));
+		}
+		return this->Red(left, value, right);
+	}
+	//glues the two subtrees of a removed node, every value of left is less than every value of right
+	NodePointer Append(const NodePointer& left, const NodePointer& right) const
+	{
+		if (!left) return right;
+		if (!right) return left;
+		if (left->red && right->red)
+		{
+			NodePointer middle = this->Append(left->right, right->left);
+			if (IsRed(middle))
+			{
+				return this->Red(this->Red(left->left, left->value, middle->left), middle->value,
+					this->Red(middle->right, right->value, right->right));
+			}
+			return this->Red(left->left, left->value, this->Red(middle, right->value, right->right));
+		}
+		if (!left->red && !right->red)
+		{
+			NodePointer middle = this->Append(left->right, right->left);
+			if (IsRed(middle))
+			{
+				return this->Red(this->Black(left->left, left->value, middle->left), middle->value,
+					this->Black(middle->right, right->value, right->right));
+			}
+			return this->ShortLeft(left->left, left->value, this->Black(middle, right->value, right->right));
+		}
+		if (right->red) return this->Red(this->Append(left, right->left), right->value, right->right);
+		return this->Red(left->left, left->value, this->Append(left->right, right));
+	}
+	template <class K> NodePointer Delete(const NodePointer& node, const K& key) const
+	{
+		if (this->compare(key, node->value))
+		{
+			if (IsBlack(node->left)) return this->ShortLeft(this->Delete(node->left, key), node->value, node->right);
+			return this->Red(this->Delete(node->left, key), node->value, node->right);
+		}
+		if (this->compare(node->value, key))
+		{
+			if (IsBlack(node->right)) return this->ShortRight(node->left, node->value, this->Delete(node->right, key));
+			return this->Red(node->left, node->value, this->Delete(node->right, key));
+		}
+		return this->Append(node->left, node->right);
+	}
+	//every reader and writer loads the root once and works on that version only
+	template <class K> const Node* Find(const NodePointer& root, const K& key) const
+	{
+		const Node* node = root.get();
+		const Node* candidate = NULL;
+		//lower bound descent, one comparison per level
+		while (node != NULL)
+		{
+			if (this->compare(node->value, key)) node = node->right.get();
+			else
+			{
+				candidate = node;
+				node = node->left.get();
+			}
+		}
+		if (candidate != NULL && !this->compare(key, candidate->value)) return candidate;
+		return NULL;
+	}
+public:
+	//in-order iterator, it keeps its version alive
+	class Iterator
+	{
+	private:
+		friend class PersistentRedBlackTree;
+		NodePointer root;
+		vector<const Node*> path;
+
+		void PushLeft(const Node* node)
+		{
+			for (; node != NULL; node = node->left.get()) this->path.push_back(node);
+		}
+	public:
+		typedef forward_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const T* pointer;
+		typedef const T& reference;
+
+		Iterator()
+		{
+		}
+		explicit Iterator(const NodePointer& root) : root(root)
+		{
+			this->PushLeft(root.get());
+		}
+		reference operator*() const
+		{
+			return this->path.back()->value;
+		}
+		pointer operator->() const
+		{
+			return &this->path.back()->value;
+		}
+		Iterator& operator++()
+		{
+			const Node* node = this->path.back();
+			this->path.pop_back();
+			this->PushLeft(node->right.get());
+			return *this;
+		}
+		Iterator operator++(int)
+		{
+			Iterator previous = *this;
+			++*this;
+			return previous;
+		}
+		bool operator==(const Iterator& other) const
+		{
+			if (this->path.empty() || other.path.empty()) return this->path.empty() == other.path.empty();
+			return this->path.back() == other.path.back();
+		}
+		bool operator!=(const Iterator& other) const
+		{
+			return !(*this == other);
+		}
+	};
+	typedef Iterator iterator;
+	typedef Iterator const_iterator;
+	typedef T value_type;
+
+	explicit PersistentRedBlackTree(const Compare& compare = Compare(), const Alloc& alloc = Alloc()) : compare(compare), nodeAllocator(alloc)
+	{
+	}
+	PersistentRedBlackTree(const PersistentRedBlackTree& other)
+		: root(atomic_load(&other.root)), compare(other.compare), nodeAllocator(other.nodeAllocator)
+	{
+	}
+	PersistentRedBlackTree& operator=(const PersistentRedBlackTree& other)
+	{
+		atomic_store(&this->root, atomic_load(&other.root));
+		return *this;
+	}
+	//the current version, O(1) and without waiting for anybody
+	PersistentRedBlackTree Snapshot() const
+	{
+		return *this;
+	}
+	bool IsEmpty() const
+	{
+		return !atomic_load(&this->root);
+	}
+
+	//the three basic functionalities (clients interface) - changes return the new version
+	//lookups return an empty handle if the value is missing
+	NodeHandle AccessNode(const T& value) const
+	{
+		NodePointer root = atomic_load(&this->root);
+		return NodeHandle(root, this->Find(root, value));
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, NodeHandle>::type AccessNode(const K& key) const
+	{
+		NodePointer root = atomic_load(&this->root);
+		return NodeHandle(root, this->Find(root, key));
+	}
+	PersistentRedBlackTree InsertNode(const T& value) const
+	{
+		NodePointer root = atomic_load(&this->root);
+		if (this->Find(root, value) != NULL) return this->WithRoot(root);
+		return this->WithRoot(this->MakeBlack(this->Insert(root, value)));
+	}
+	PersistentRedBlackTree DeleteNode(const T& value) const
+	{
+		NodePointer root = atomic_load(&this->root);
+		if (this->Find(root, value) == NULL) return this->WithRoot(root);
+		return this->WithRoot(this->MakeBlack(this->Delete(root, value)));
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, PersistentRedBlackTree>::type DeleteNode(const K& key) const
+	{
+		NodePointer root = atomic_load(&this->root);
+		if (this->Find(root, key) == NULL) return this->WithRoot(root);
+		return this->WithRoot(this->MakeBlack(this->Delete(root, key)));
+	}
+
+	Iterator begin() const
+	{
+		return Iterator(atomic_load(&this->root));
+	}
+	Iterator end() const
+	{
+		return Iterator();
+	}
+};
+
+#endif
@@ -0,0 +1,203 @@
+/*
+Red Black Map
+key-value variant of the red black tree
+released under GNU GPL licence
+*/
+#ifndef RED_BLACK_MAP_H
+#define RED_BLACK_MAP_H
+
+#include <tuple>
+#include <utility>
+#include <iterator>
+#include "RedBlackTree.h"
+
+using namespace std;
+
+//orders key-value pairs by key only and lets a bare key be compared against a pair
+template <class K, class V, class Compare> struct MapKeyCompare
+{
+	typedef void is_transparent;
+	typedef pair<const K, V> ValueType;
+	Compare compare;
+
+	MapKeyCompare(const Compare& compare = Compare()) : compare(compare)
+	{
+	}
+	bool operator()(const ValueType& a, const ValueType& b) const
+	{
+		return this->compare(a.first, b.first);
+	}
+	template <class Key> bool operator()(const ValueType& a, const Key& b) const
+	{
+		return this->compare(a.first, b);
+	}
+	template <class Key> bool operator()(const Key& a, const ValueType& b) const
+	{
+		return this->compare(a, b.first);
+	}
+};
+
+template <class K, class V, class Compare = less<K>, class Alloc = allocator<pair<const K, V> > > class RedBlackMap
+{
+public:
+	typedef pair<const K, V> ValueType;
+	typedef RBNode<ValueType> Node;
+private:
+	typedef RedBlackTree<ValueType, MapKeyCompare<K, V, Compare>, Alloc> Tree;
+	Tree tree;
+public:
+	//bidirectional in-order iterator over the key-value pairs, the mapped values can be updated through it
+	class Iterator
+	{
+	private:
+		friend class RedBlackMap;
+		typename Tree::Iterator it;
+
+		explicit Iterator(const typename Tree::Iterator& it) : it(it)
+		{
+		}
+	public:
+		typedef bidirectional_iterator_tag iterator_category;
+		typedef ValueType value_type;
+		typedef ptrdiff_t difference_type;
+		typedef ValueType* pointer;
+		typedef ValueType& reference;
+
+		Iterator()
+		{
+		}
+		Node* GetNode() const
+		{
+			return this->it.GetNode();
+		}
+		//the key is const inside the pair, so the order cannot change
+		reference operator*() const
+		{
+			return const_cast<ValueType&>(*this->it);
+		}
+		pointer operator->() const
+		{
+			return &**this;
+		}
+		Iterator& operator++()
+		{
+			++this->it;
+			return *this;
+		}
+		Iterator operator++(int)
+		{
+			Iterator previous = *this;
+			++this->it;
+			return previous;
+		}
+		Iterator& operator--()
+		{
+			--this->it;
+			return *this;
+		}
+		Iterator operator--(int)
+		{
+			Iterator previous = *this;
+			--this->it;
+			return previous;
+		}
+		bool operator==(const Iterator& other) const
+		{
+			return this->it == other.it;
+		}
+		bool operator!=(const Iterator& other) const
+		{
+			return this->it != other.it;
+		}
+	};
+	typedef Iterator iterator;
+	typedef ValueType value_type;
+
+	explicit RedBlackMap(const Compare& compare = Compare(), const Alloc& alloc = Alloc())
+		: tree(MapKeyCompare<K, V, Compare>(compare), alloc)
+	{
+	}
+	bool IsEmpty()
+	{
+		return this->tree.IsEmpty();
+	}
+	//the key inside a node is const, the mapped value can be updated in place without any structural change
+	static V& GetMapped(Node* node)
+	{
+		return const_cast<ValueType&>(node->GetValue()).second;
+	}
+
+	//the three basic functionalities, keyed on K
+	Node* AccessNode(const K& key)
+	{
+		return this->tree.AccessNode(key);
+	}
+	V* AccessValue(const K& key)
+	{
+		Node* node = this->tree.AccessNode(key);
+		if (node == NULL) return NULL;
+		return &GetMapped(node);
+	}
+	void InsertNode(const K& key, const V& value)
+	{
+		this->tree.TryEmplace(key, key, value);
+	}
+	void DeleteNode(const K& key)
+	{
+		this->tree.DeleteNode(key);
+	}
+	void ReleaseAll()
+	{
+		this->tree.ReleaseAll();
+	}
+
+	//in-order traversal and range scans by key: O(log n + k) for k visited pairs
+	Iterator begin()
+	{
+		return Iterator(this->tree.begin());
+	}
+	Iterator end()
+	{
+		return Iterator(this->tree.end());
+	}
+	Iterator lower_bound(const K& key)
+	{
+		return Iterator(this->tree.lower_bound(key));
+	}
+	Iterator upper_bound(const K& key)
+	{
+		return Iterator(this->tree.upper_bound(key));
+	}
+
+	//std::map style updates - each of them is a single descent
+	V& operator[](const K& key)
+	{
+		return GetMapped(this->tree.TryEmplace(key, piecewise_construct, forward_as_tuple(key), forward_as_tuple()).first);
+	}
+	V& operator[](K&& key)
+	{
+		return GetMapped(this->tree.TryEmplace(key, piecewise_construct, forward_as_tuple(move(key)), forward_as_tuple()).first);
+	}
+	template <class... Args> pair<Node*, bool> try_emplace(const K& key, Args&&... args)
+	{
+		return this->tree.TryEmplace(key, piecewise_construct, forward_as_tuple(key), forward_as_tuple(forward<Args>(args)...));
+	}
+	template <class... Args> pair<Node*, bool> try_emplace(K&& key, Args&&... args)
+	{
+		return this->tree.TryEmplace(key, piecewise_construct, forward_as_tuple(move(key)), forward_as_tuple(forward<Args>(args)...));
+	}
+	template <class M> pair<Node*, bool> insert_or_assign(const K& key, M&& value)
+	{
+		pair<Node*, bool> result = this->tree.TryEmplace(key, key, forward<M>(value));
+		if (!result.second) GetMapped(result.first) = forward<M>(value);
+		return result;
+	}
+	template <class M> pair<Node*, bool> insert_or_assign(K&& key, M&& value)
+	{
+		pair<Node*, bool> result = this->tree.TryEmplace(key, move(key), forward<M>(value));
+		if (!result.second) GetMapped(result.first) = forward<M>(value);
+		return result;
+	}
+};
+
+#endif
@@ -3,278 +3,2025 @@ Red Black Tree
 by Plamen Dimitrov
 released under GNU GPL licence
 */
+#ifndef RED_BLACK_TREE_H
+#define RED_BLACK_TREE_H
+
+#include <stdint.h>
 #include <queue>
+#include <deque>
 #include <stack>
-#include <windows.h> //for coloring output only
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <utility>
+#include <iterator>
+#include <cstddef>
+#include <type_traits>
+#include <limits>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <iostream>
+#include <string>
+#if defined(_WIN32)
+#include <windows.h> //only to let the console understand ANSI colors
+#endif
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+#if defined(RED_BLACK_TREE_STATS)
+#include <chrono>
+#include <atomic>
+#endif
+#include "NodePool.h"
 
 using namespace std;
 
-template <class T> class RBNode
+//augmentation policies keep extra data per node that depends on the node's subtree
+//Update recomputes that data from the node's children, the tree calls it bottom-up wherever the shape changes
+struct NoAugment
+{
+	struct Data
+	{
+	};
+	template <class Node> static void Update(Node*)
+	{
+	}
+};
+//subtree sizes for rank and select queries
+struct OrderStatistics
+{
+	struct Data
+	{
+		size_t subtreeSize;
+		Data() : subtreeSize(1)
+		{
+		}
+	};
+	template <class Node> static void Update(Node* node)
+	{
+		size_t subtreeSize = 1;
+		if (node->GetLeft() != NULL) subtreeSize += node->GetLeft()->GetAugment().subtreeSize;
+		if (node->GetRight() != NULL) subtreeSize += node->GetRight()->GetAugment().subtreeSize;
+		node->GetAugment().subtreeSize = subtreeSize;
+	}
+};
+
+//aggregate of a monoid over every subtree, on top of the Base augmentation
+//Monoid gives ValueType, Identity(), Lift(value) and an associative Combine(a, b) - combined in key order
+template <class MonoidType, class Base = NoAugment> struct MonoidAugment
+{
+	typedef MonoidType Monoid;
+	struct Data : Base::Data
+	{
+		typename Monoid::ValueType aggregate;
+	};
+	template <class Node> static void Update(Node* node)
+	{
+		Base::Update(node);
+		typename Monoid::ValueType aggregate = Monoid::Lift(node->GetValue());
+		if (node->GetLeft() != NULL) aggregate = Monoid::Combine(node->GetLeft()->GetAugment().aggregate, aggregate);
+		if (node->GetRight() != NULL) aggregate = Monoid::Combine(aggregate, node->GetRight()->GetAugment().aggregate);
+		node->GetAugment().aggregate = aggregate;
+	}
+};
+template <class T, class Sum = T> struct SumMonoid
+{
+	typedef Sum ValueType;
+	static ValueType Identity()
+	{
+		return ValueType();
+	}
+	static ValueType Lift(const T& value)
+	{
+		return ValueType(value);
+	}
+	static ValueType Combine(const ValueType& a, const ValueType& b)
+	{
+		return a + b;
+	}
+};
+template <class T> struct MinMonoid
+{
+	typedef T ValueType;
+	static ValueType Identity()
+	{
+		return numeric_limits<T>::max();
+	}
+	static ValueType Lift(const T& value)
+	{
+		return value;
+	}
+	static ValueType Combine(const ValueType& a, const ValueType& b)
+	{
+		return b < a ? b : a;
+	}
+};
+template <class T> struct MaxMonoid
+{
+	typedef T ValueType;
+	static ValueType Identity()
+	{
+		return numeric_limits<T>::lowest();
+	}
+	static ValueType Lift(const T& value)
+	{
+		return value;
+	}
+	static ValueType Combine(const ValueType& a, const ValueType& b)
+	{
+		return a < b ? b : a;
+	}
+};
+
+template <class T, class Augment = NoAugment> class RBNode : private Augment::Data
 {
 private:
-	bool isRed;
+	//parent pointer with the color packed into its lowest bit and the queued mark of relaxed balance into the next one
+	//nodes are at least pointer aligned so those bits of a real address are always zero
+	uintptr_t parentAndColor;
+	RBNode *left, *right;
 	T value;
-	RBNode<T> *left, *right, *parent;
+
+	void SetParent(RBNode* parent)
+	{
+		this->parentAndColor = reinterpret_cast<uintptr_t>(parent) | (this->parentAndColor & 3);
+	}
 public:
 	//Node()
 	//{
 	//	left = NULL;
 	//	right = NULL;
 	//}
-	RBNode(T value)
+	//the value is constructed in place from whatever arguments are given, red without parent
+	template <class... Args> explicit RBNode(Args&&... args) : parentAndColor(1), left(NULL), right(NULL), value(forward<Args>(args)...)
 	{
-		this->isRed = true;
-		this->value = value;
-		left = NULL;
-		right = NULL;
-		parent = NULL;
 	}
 	void Recolor()
 	{
-		if (this->isRed) this->isRed = false;
-		else this->isRed = true;
+		this->parentAndColor ^= 1;
+	}
+	typename Augment::Data& GetAugment()
+	{
+		return *this;
+	}
+	const typename Augment::Data& GetAugment() const
+	{
+		return *this;
 	}
-	bool IsRed()
+	bool IsRed() const
 	{
-		return isRed;
+		return (this->parentAndColor & 1) != 0;
 	}
-	T GetValue()
+	const T& GetValue() const
 	{
 		return this->value;
 	}
-	RBNode* GetLeft()
+	RBNode* GetLeft() const
 	{
 		return this->left;
 	}
-	RBNode* GetRight()
+	RBNode* GetRight() const
 	{
 		return this->right;
 	}
-	RBNode* GetParent()
+	RBNode* GetParent() const
 	{
-		return this->parent;
+		return reinterpret_cast<RBNode*>(this->parentAndColor & ~(uintptr_t)3);
 	}
 	void ClearParent()
 	{
-		this->parent = NULL;
+		this->parentAndColor &= 3;
+	}
+	//whether the node waits in the queue of RedBlackTree::Rebalance
+	bool IsQueued() const
+	{
+		return (this->parentAndColor & 2) != 0;
+	}
+	void SetQueued(bool queued)
+	{
+		this->parentAndColor = (this->parentAndColor & ~(uintptr_t)2) | (queued ? 2 : 0);
 	}
 	void SetLeft(RBNode* left)
 	{
 		this->left = left;
-		if(left != NULL) left->parent = this;
+		if(left != NULL) left->SetParent(this);
 	}
 	void SetRight(RBNode* right)
 	{
 		this->right = right;
-		if(right != NULL) right->parent = this;
+		if(right != NULL) right->SetParent(this);
 	}
 };
 
-template <class T> class RedBlackTree
+//three pointers and the value, no separate color field and no padding for it
+template <class T> struct RBNodeSizeReport
 {
-private:
-	RBNode<T>* root;
+	static const size_t pointers = 3 * sizeof(void*);
+	static const size_t compact = (pointers + sizeof(T) + alignof(RBNode<T>) - 1) / alignof(RBNode<T>) * alignof(RBNode<T>);
+	static const size_t actual = sizeof(RBNode<T>);
+};
+static_assert(alignof(RBNode<char>) >= 4, "the color bit and the queued mark need two free low bits in node addresses");
+static_assert(RBNodeSizeReport<char>::actual == RBNodeSizeReport<char>::compact, "RBNode<char> is not compact");
+static_assert(RBNodeSizeReport<int>::actual == RBNodeSizeReport<int>::compact, "RBNode<int> is not compact");
+static_assert(RBNodeSizeReport<long long>::actual == RBNodeSizeReport<long long>::compact, "RBNode<long long> is not compact");
+static_assert(RBNodeSizeReport<double>::actual == RBNodeSizeReport<double>::compact, "RBNode<double> is not compact");
+static_assert(RBNodeSizeReport<void*>::actual == RBNodeSizeReport<void*>::compact, "RBNode<void*> is not compact");
 
-	//the three basic functionalities (inner implementation)
-	RBNode<T>* AccessNode(RBNode<T> *root, T value)
+//comparators declaring is_transparent may be called with any key type (heterogeneous lookup)
+template <class> struct VoidType
+{
+	typedef void type;
+};
+template <class Compare, class = void> struct IsTransparent : false_type
+{
+};
+template <class Compare> struct IsTransparent<Compare, typename VoidType<typename Compare::is_transparent>::type> : true_type
+{
+};
+
+//output policies of LevelTraversal - they decide how a value shows its color
+//ANSI escape codes for terminals, red values in bright red as the Windows console attributes used to show them
+struct AnsiColorOutput
+{
+	AnsiColorOutput()
+	{
+#if defined(_WIN32)
+		//consoles older than Windows Terminal interpret the escape codes only when asked to
+		HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+		DWORD mode = 0;
+		if (console != INVALID_HANDLE_VALUE && GetConsoleMode(console, &mode)) SetConsoleMode(console, mode | 0x0004); //ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#endif
+	}
+	template <class T> void Write(ostream& out, const T& value, bool red) const
+	{
+		if (red) out << "\x1b[91m" << value << "\x1b[0m";
+		else out << value;
+	}
+};
+//no escape codes for files and logs, red values are marked with a star
+struct PlainOutput
+{
+	template <class T> void Write(ostream& out, const T& value, bool red) const
 	{
-		if(root->GetValue() == value)
+		out << value;
+		if (red) out << "*";
+	}
+};
+
+//hot path counters, compiled in only when RED_BLACK_TREE_STATS is defined (the RB_TREE_STATS option of CMake)
+//otherwise the statements in RED_BLACK_TREE_COUNT vanish and RedBlackTree::Stats() is an empty snapshot
+#if defined(RED_BLACK_TREE_STATS)
+#define RED_BLACK_TREE_COUNT(statement) statement
+#else
+#define RED_BLACK_TREE_COUNT(statement)
+#endif
+
+//snapshot of the counters of one tree, plain data to copy out and scrape
+struct RedBlackTreeStats
+{
+#if defined(RED_BLACK_TREE_STATS)
+	static const bool Enabled = true;
+#else
+	static const bool Enabled = false;
+#endif
+	//every rotation function of the rebalancing, the First..Forth ones are the delete cases 1.1, 2.1.1, 2.1.2 and 2.2.1
+	enum Rotation { LeftRotation, RightRotation, FirstLRotation, FirstRRotation, SecondLRotation, SecondRRotation,
+		ThirdLRotation, ThirdRRotation, ForthLRotation, ForthRRotation, Rotations };
+	static const size_t MaxDepth = 128;
+	static const size_t LatencyBuckets = 40;
+
+	//operation latencies in power of two buckets: bucket i counts the ones that took [2^i, 2^(i+1)) ns
+	struct LatencyHistogram
+	{
+		uint64_t count;
+		uint64_t totalNs;
+		uint64_t buckets[LatencyBuckets];
+
+		static size_t Bucket(uint64_t ns)
 		{
-			return root;
+			size_t bucket = 0;
+			while (bucket + 1 < LatencyBuckets && ((uint64_t)2 << bucket) <= ns) bucket++;
+			return bucket;
 		}
-		else if(root->GetValue() > value)
+		void Record(uint64_t ns)
 		{
-			if(root->GetLeft() == NULL)
-			{
-				return NULL;
-			}
-			else
-			{
-				return this->AccessNode(root->GetLeft(), value);
-			}
+			this->buckets[Bucket(ns)]++;
+			this->count++;
+			this->totalNs += ns;
 		}
-		else
+		//upper end of the bucket holding the given quantile, 0 with nothing recorded
+		uint64_t QuantileNs(double quantile) const
 		{
-			if(root->GetRight() == NULL)
-			{
-				return NULL;
-			}
-			else
+			uint64_t seen = 0;
+			for (size_t i = 0; i < LatencyBuckets; i++)
 			{
-				return this->AccessNode(root->GetRight(), value);
+				seen += this->buckets[i];
+				if (seen > 0 && seen >= quantile * this->count) return (uint64_t)2 << i;
 			}
+			return 0;
 		}
+	};
+
+	//lower bound descents (AccessNode, DeleteNode, lower_bound) and insertion descents,
+	//with their comparisons - one per level and the equality check at the bottom
+	uint64_t searches;
+	uint64_t searchComparisons;
+	uint64_t insertSearches;
+	uint64_t insertComparisons;
+	//how many descents ended at each depth, the root is at depth 1
+	uint64_t depths[MaxDepth];
+	uint64_t maxDepth;
+	uint64_t rotations[Rotations];
+	//colors flipped directly by SolveDoubleRedProblem and RestoreReducedHeight, not counting those inside rotations
+	uint64_t doubleRedRecolors;
+	uint64_t reducedHeightRecolors;
+	//rotations and color flips of the top-down insertion and deletion, all made on the way down
+	uint64_t topDownRotations;
+	uint64_t topDownRecolors;
+	LatencyHistogram lookupLatency;
+	LatencyHistogram insertLatency;
+	LatencyHistogram deleteLatency;
+
+	//RedBlackTreeStats() is all zeros
+	void Reset()
+	{
+		*this = RedBlackTreeStats();
+	}
+	uint64_t TotalRotations() const
+	{
+		uint64_t total = 0;
+		for (size_t i = 0; i < Rotations; i++) total += this->rotations[i];
+		return total;
+	}
+	static const char* RotationName(size_t rotation)
+	{
+		static const char* const names[Rotations] = { "LeftRotate", "RightRotate", "FirstLRotate", "FirstRRotate", "SecondLRotate",
+			"SecondRRotate", "ThirdLRotate", "ThirdRRotate", "ForthLRotate", "ForthRRotate" };
+		return rotation < Rotations ? names[rotation] : "";
 	}
-	void InsertNode(RBNode<T> *root, T value)
+
+#if defined(RED_BLACK_TREE_STATS)
+	//the same histogram for lookups, which may run on many threads at once
+	struct SharedLatencyHistogram
 	{
-		//regular BST insert
-		RBNode<T>* insertedNode = NULL;
-		if(root->GetValue() == value)
+		atomic<uint64_t> count;
+		atomic<uint64_t> totalNs;
+		atomic<uint64_t> buckets[LatencyBuckets];
+
+		void Record(uint64_t ns)
 		{
-			//skip
+			this->buckets[LatencyHistogram::Bucket(ns)].fetch_add(1, memory_order_relaxed);
+			this->count.fetch_add(1, memory_order_relaxed);
+			this->totalNs.fetch_add(ns, memory_order_relaxed);
 		}
-		else if(root->GetValue() > value)
+		void Reset()
 		{
-			if(root->GetLeft() == NULL)
-			{
-				insertedNode = new RBNode<T>(value);
-				root->SetLeft(insertedNode);
-			}
-			else
-			{
-				this->InsertNode(root->GetLeft(), value);
-			}
+			this->count.store(0, memory_order_relaxed);
+			this->totalNs.store(0, memory_order_relaxed);
+			for (size_t i = 0; i < LatencyBuckets; i++) this->buckets[i].store(0, memory_order_relaxed);
 		}
-		else
+		void CopyTo(LatencyHistogram& histogram) const
+		{
+			histogram.count = this->count.load(memory_order_relaxed);
+			histogram.totalNs = this->totalNs.load(memory_order_relaxed);
+			for (size_t i = 0; i < LatencyBuckets; i++) histogram.buckets[i] = this->buckets[i].load(memory_order_relaxed);
+		}
+	};
+	//the counters lookups update, relaxed atomics as ConcurrentRedBlackTree runs lookups on many threads at once
+	//every other counter is only updated by changes, which are never concurrent, and stays plain
+	struct SharedCounters
+	{
+		atomic<uint64_t> searches;
+		atomic<uint64_t> searchComparisons;
+		atomic<uint64_t> depths[MaxDepth];
+		atomic<uint64_t> maxDepth;
+		SharedLatencyHistogram lookupLatency;
+
+		SharedCounters()
+		{
+			this->Reset();
+		}
+		void Reset()
+		{
+			this->searches.store(0, memory_order_relaxed);
+			this->searchComparisons.store(0, memory_order_relaxed);
+			for (size_t i = 0; i < MaxDepth; i++) this->depths[i].store(0, memory_order_relaxed);
+			this->maxDepth.store(0, memory_order_relaxed);
+			this->lookupLatency.Reset();
+		}
+		void AddComparisons(uint64_t comparisons)
 		{
-			if(root->GetRight() == NULL)
+			this->searchComparisons.fetch_add(comparisons, memory_order_relaxed);
+		}
+		void AddSearch(uint64_t comparisons, size_t depth)
+		{
+			this->searches.fetch_add(1, memory_order_relaxed);
+			this->AddComparisons(comparisons);
+			this->RecordDepth(depth);
+		}
+		void RecordDepth(size_t depth)
+		{
+			this->depths[depth < MaxDepth ? depth : MaxDepth - 1].fetch_add(1, memory_order_relaxed);
+			uint64_t deepest = this->maxDepth.load(memory_order_relaxed);
+			while (depth > deepest && !this->maxDepth.compare_exchange_weak(deepest, depth, memory_order_relaxed))
 			{
-				insertedNode = new RBNode<T>(value);
-				root->SetRight(insertedNode);
 			}
-			else
+		}
+		void CopyTo(RedBlackTreeStats& stats) const
+		{
+			stats.searches = this->searches.load(memory_order_relaxed);
+			stats.searchComparisons = this->searchComparisons.load(memory_order_relaxed);
+			for (size_t i = 0; i < MaxDepth; i++) stats.depths[i] = this->depths[i].load(memory_order_relaxed);
+			stats.maxDepth = this->maxDepth.load(memory_order_relaxed);
+			this->lookupLatency.CopyTo(stats.lookupLatency);
+		}
+	};
+
+	//times the scope it lives in into a histogram
+	template <class Histogram> class ScopeTimer
+	{
+	private:
+		Histogram& histogram;
+		chrono::steady_clock::time_point start;
+	public:
+		explicit ScopeTimer(Histogram& histogram) : histogram(histogram), start(chrono::steady_clock::now())
+		{
+		}
+		~ScopeTimer()
+		{
+			this->histogram.Record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - this->start).count());
+		}
+	};
+	typedef ScopeTimer<LatencyHistogram> Timer;
+	typedef ScopeTimer<SharedLatencyHistogram> SharedTimer;
+#endif
+};
+
+//what RedBlackTree::Validate() found - every rule is checked at every node, the counters say how often each one is broken
+struct RedBlackTreeReport
+{
+	size_t nodes;
+	//black nodes on the paths from the root down, as BlackHeight() counts them
+	size_t blackHeight;
+	size_t maxDepth;
+	size_t redRoot;
+	//red nodes with a red child
+	size_t redRedViolations;
+	//nodes whose two subtrees differ in black height
+	size_t blackHeightViolations;
+	//in-order neighbours not strictly increasing by Compare
+	size_t orderViolations;
+	//children whose parent link points elsewhere, they are not descended into, and a root with a parent
+	size_t parentViolations;
+	//subtree sizes kept by OrderStatistics that do not match
+	size_t sizeViolations;
+	//paths longer than any red black tree can have, which only a cycle makes
+	size_t depthViolations;
+	//the first broken rule in words, empty for a valid tree
+	string firstViolation;
+
+	//RedBlackTreeReport() is a valid empty tree
+	bool IsValid() const
+	{
+		return this->redRoot == 0 && this->redRedViolations == 0 && this->blackHeightViolations == 0 && this->orderViolations == 0
+			&& this->parentViolations == 0 && this->sizeViolations == 0 && this->depthViolations == 0;
+	}
+	void Add(size_t& violations, const char* rule, size_t position, size_t depth)
+	{
+		if (this->IsValid()) this->firstViolation = string(rule) + " at in-order position " + to_string(position) + ", depth " + to_string(depth);
+		violations++;
+	}
+};
+
+//read only copy made by RedBlackTree::Freeze(), defined in FrozenRedBlackTree.h
+template <class T, class Compare> class FrozenRedBlackTree;
+//read only k-ary copy made by RedBlackTree::ExportBTree(), defined in StaticBTree.h
+template <class T> class StaticBTree;
+
+template <class T, class Compare = less<T>, class Alloc = allocator<T>, class Augment = NoAugment> class RedBlackTree
+{
+public:
+	typedef RBNode<T, Augment> Node;
+private:
+	typedef typename allocator_traits<Alloc>::template rebind_alloc<Node> NodeAllocator;
+	typedef allocator_traits<NodeAllocator> NodeAllocatorTraits;
+
+	Node* root;
+	Compare compare;
+	NodeAllocator nodeAllocator;
+	//contiguous blocks from bulk builds - their nodes are recycled through bulkFreeList instead of freed one by one
+	//joins and splits may spread a block over several trees, it is freed by the last of them letting go of it
+	//kept sorted by address, so the block of a node is found by binary search however many chunks a load appended
+	typedef pair<shared_ptr<Node>, size_t> Block;
+	vector<Block> blocks;
+	Node* bulkFreeList;
+	//relaxed balance, as in chromatic trees: insertion and deletion only record the rules they break, Rebalance repairs them
+	bool relaxedBalance;
+	//nodes that may be red under a red parent or carry extra blackness, each marked queued and listed once
+	//a deque grows block by block, a burst never waits for the whole queue to be copied
+	//a node deleted while queued is only unlinked, Rebalance frees it when it gets to it
+	deque<Node*> rebalanceQueue;
+	//blackness a queued black node carries on top of its own, left by relaxed deletions - every path through the node counts it
+	unordered_map<Node*, size_t> extraBlackness;
+	RED_BLACK_TREE_COUNT(RedBlackTreeStats stats = RedBlackTreeStats();)
+	RED_BLACK_TREE_COUNT(RedBlackTreeStats::SharedCounters sharedStats;)
+
+	RedBlackTree(const RedBlackTree&) = delete;
+	RedBlackTree& operator=(const RedBlackTree&) = delete;
+
+	//node memory goes through the allocator
+	template <class... Args> Node* CreateNode(Args&&... args)
+	{
+		Node* node;
+		if (this->bulkFreeList != NULL)
+		{
+			node = this->bulkFreeList;
+			this->bulkFreeList = *reinterpret_cast<Node**>(node);
+		}
+		else node = NodeAllocatorTraits::allocate(this->nodeAllocator, 1);
+		NodeAllocatorTraits::construct(this->nodeAllocator, node, forward<Args>(args)...);
+		return node;
+	}
+	void DestroyNode(Node* node)
+	{
+		NodeAllocatorTraits::destroy(this->nodeAllocator, node);
+		if (this->InBlock(node)) this->PushBulkFree(node);
+		else NodeAllocatorTraits::deallocate(this->nodeAllocator, node, 1);
+	}
+	static bool BlockAfter(Node* node, const Block& block)
+	{
+		return less<Node*>()(node, block.first.get());
+	}
+	bool InBlock(Node* node)
+	{
+		typename vector<Block>::iterator block = std::upper_bound(this->blocks.begin(), this->blocks.end(), node, BlockAfter);
+		if (block == this->blocks.begin()) return false;
+		--block;
+		return less<Node*>()(node, block->first.get() + block->second);
+	}
+	void PushBulkFree(Node* node)
+	{
+		*reinterpret_cast<Node**>(node) = this->bulkFreeList;
+		this->bulkFreeList = node;
+	}
+	void ReleaseBlocks()
+	{
+		this->blocks.clear();
+		this->bulkFreeList = NULL;
+	}
+	void AddBlock(Node* nodes, size_t count)
+	{
+		NodeAllocator allocator = this->nodeAllocator;
+		this->blocks.insert(std::upper_bound(this->blocks.begin(), this->blocks.end(), nodes, BlockAfter), Block(shared_ptr<Node>(nodes, [allocator, count](Node* nodes) mutable
+		{
+			NodeAllocatorTraits::deallocate(allocator, nodes, count);
+		}), count));
+	}
+	//a tree taking over nodes of another one keeps their blocks alive as well - both lists are sorted, so they are merged
+	void ShareBlocks(const RedBlackTree& other)
+	{
+		vector<Block> merged;
+		merged.reserve(this->blocks.size() + other.blocks.size());
+		size_t i = 0, j = 0;
+		while (i < this->blocks.size() || j < other.blocks.size())
+		{
+			if (j == other.blocks.size() || (i < this->blocks.size() && less<Node*>()(this->blocks[i].first.get(), other.blocks[j].first.get())))
 			{
-				this->InsertNode(root->GetRight(), value);
+				merged.push_back(move(this->blocks[i++]));
+				continue;
 			}
+			if (i < this->blocks.size() && this->blocks[i].first == other.blocks[j].first) i++;
+			merged.push_back(other.blocks[j++]);
 		}
-		//restore uniform black height
-		if (insertedNode == NULL) return;
-		this->SolveDoubleRedProblem(root);
-		insertedNode = NULL;
+		this->blocks.swap(merged);
+	}
+	//the deepest level of a balanced tree of that size is red - none if it is only the root
+	static size_t RedDepth(size_t count)
+	{
+		size_t redDepth = 0;
+		while (((size_t)2 << redDepth) <= count) redDepth++;
+		if (redDepth == 0) redDepth = (size_t)-1;
+		return redDepth;
+	}
+	static Node* NodeAt(Node* nodes, size_t i)
+	{
+		return nodes + i;
+	}
+	static Node* NodeAt(Node** nodes, size_t i)
+	{
+		return nodes[i];
+	}
+	//links the sorted nodes [low, high) of an array of nodes or of node pointers into a perfectly balanced subtree
+	//only the deepest level is red, so every path to a leaf has the same black height
+	template <class NodeArray> Node* LinkSorted(NodeArray nodes, size_t low, size_t high, size_t depth, size_t redDepth)
+	{
+		if (low == high) return NULL;
+		size_t middle = low + (high - low) / 2;
+		Node* root = NodeAt(nodes, middle);
+		root->SetLeft(this->LinkSorted(nodes, low, middle, depth + 1, redDepth));
+		root->SetRight(this->LinkSorted(nodes, middle + 1, high, depth + 1, redDepth));
+		if (depth != redDepth) root->Recolor();
+		this->UpdateAugment(root);
+		return root;
+	}
+	//augmented data is recomputed bottom-up wherever the shape changes - all of it compiles away without augmentation
+	static const bool IsAugmented = !is_same<Augment, NoAugment>::value;
+	void UpdateAugment(Node* node)
+	{
+		if (IsAugmented && node != NULL) Augment::Update(node);
+	}
+	//after a rotation only the new subtree root and its two children have different subtrees
+	void UpdateRotated(Node* root)
+	{
+		if (!IsAugmented) return;
+		this->UpdateAugment(root->GetLeft());
+		this->UpdateAugment(root->GetRight());
+		this->UpdateAugment(root);
+	}
+	//a node was added or removed below: every ancestor is affected
+	void UpdatePath(Node* node)
+	{
+		if (!IsAugmented) return;
+		while (node != NULL)
+		{
+			Augment::Update(node);
+			node = node->GetParent();
+		}
+	}
+	//bulk release: whole chunks are dropped when nothing has to be destroyed node by node
+	void ReleaseAll(true_type)
+	{
+		this->ForgetViolations();
+		//other trees drawing from the same pool keep their nodes, this one's are then freed one by one
+		if (!this->IsSolePoolUser())
+		{
+			this->ReleaseAll(false_type());
+			return;
+		}
+		//blocks first - a single node block may come from the pool itself
+		this->ReleaseBlocks();
+		this->nodeAllocator.ReleaseAll();
+		this->root = NULL;
+	}
+	//the pool is shared by this tree's allocator and by the one in the deleter of every block, as long as no other tree holds the block
+	bool IsSolePoolUser()
+	{
+		long users = 1;
+		for (size_t i = 0; i < this->blocks.size(); i++, users++) if (this->blocks[i].first.use_count() != 1) return false;
+		return this->nodeAllocator.UseCount() == users;
+	}
+	void ReleaseAll(false_type)
+	{
+		this->ForgetViolations();
+		this->DestroySubtree(this->root);
+		this->ReleaseBlocks();
+		this->root = NULL;
+	}
+	//before the tree goes: the deleted nodes still queued are freed, the queue of the others dropped
+	void ForgetViolations()
+	{
+		for (size_t i = 0; i < this->rebalanceQueue.size(); i++)
+		{
+			Node* node = this->rebalanceQueue[i];
+			node->SetQueued(false);
+			if (this->IsDeleted(node)) this->DestroyNode(node);
+		}
+		this->rebalanceQueue.clear();
+		this->extraBlackness.clear();
 	}
-	void DeleteNode(RBNode<T> *root, T value)
+	void DestroySubtree(Node *root)
 	{
-		if(root->GetValue() == value)
+		if (root == NULL) return;
+		root->ClearParent();
+		//post-order walk over parent pointers - no stack needed
+		Node* node = root;
+		while (node != NULL)
 		{
-			RBNode<T> *leftmostFromRight;
-			if (root->GetLeft() == NULL) leftmostFromRight = root->GetRight();
-			else if (root->GetRight() == NULL) leftmostFromRight = root->GetLeft();
-			else if (root->GetLeft()->GetRight() == NULL) leftmostFromRight = root->GetLeft();
-			else if (root->GetRight()->GetLeft() == NULL) leftmostFromRight = root->GetRight();
-			//symmetrical after the four exceptional cases above - left implemented
+			if (node->GetLeft() != NULL) node = node->GetLeft();
+			else if (node->GetRight() != NULL) node = node->GetRight();
 			else
 			{
-				leftmostFromRight = root->GetRight()->GetLeft();
-				while (leftmostFromRight->GetLeft() != NULL)
+				Node* parent = node->GetParent();
+				if (parent != NULL)
 				{
-					leftmostFromRight = leftmostFromRight->GetLeft();
+					if (parent->GetLeft() == node) parent->SetLeft(NULL);
+					else parent->SetRight(NULL);
 				}
-			}			
-			if (leftmostFromRight == NULL)
-			{
-				//reballance by checking for red-black tree deletion preliminaries in both cases
-				if (root->GetLeft() != NULL) root->GetLeft()->Recolor(); 
-				else if (root->GetRight() != NULL) root->GetRight()->Recolor();
-				//this case is possible only if (leftmostFromRight != root->GetLeft() && root->GetLeft() != NULL)
-				else if (!root->IsRed()) RestoreReducedHeight(root);
+				this->DestroyNode(node);
+				node = parent;
 			}
-			else
-			{
-				//leftmostFromRight is always black and its single child is always red - first condition is possible bacause of the four exceptional cases
-				if (leftmostFromRight->GetLeft() != NULL) leftmostFromRight->GetLeft()->Recolor(); 
-				else if (leftmostFromRight->GetRight() != NULL) leftmostFromRight->GetRight()->Recolor();
-				//this case is possible only if (leftmostFromRight != root->GetLeft() && root->GetLeft() != NULL)
-				else if (!leftmostFromRight->IsRed()) RestoreReducedHeight(leftmostFromRight);
-				if (leftmostFromRight != root->GetLeft() && leftmostFromRight != root->GetRight()) leftmostFromRight->GetParent()->SetLeft(leftmostFromRight->GetRight());
+		}
+	}
 
-				//replace with originally removed node
-				//include the above cases where leftmost is child of the root
-				if (leftmostFromRight != root->GetLeft() && root->GetLeft() != NULL) leftmostFromRight->SetLeft(root->GetLeft());
-				if (leftmostFromRight != root->GetRight() && root->GetRight() != NULL) leftmostFromRight->SetRight(root->GetRight());
-				//recolor if necessary
-				if (root->IsRed() && !leftmostFromRight->IsRed()) leftmostFromRight->Recolor();
-				if (!root->IsRed() && leftmostFromRight->IsRed()) leftmostFromRight->Recolor();
+	//the three basic functionalities (inner implementation)
+	//all of them descend iteratively so no call frame is spent per level
+	//and compare only once per level: equality is checked a single time at the bottom
+	template <class K> Node* AccessNode(Node *root, const K& key)
+	{
+		Node* candidate = this->LowerBound(root, key);
+		RED_BLACK_TREE_COUNT(if (candidate != NULL) this->sharedStats.AddComparisons(1);)
+		if (candidate != NULL && !this->compare(key, candidate->GetValue())) return candidate;
+		return NULL;
+	}
+	//AccessNode for a batch of keys: BatchSearches searches are in flight, each going one level down per turn
+	//the node a search reads next is prefetched a whole turn earlier, so the misses of all of them overlap
+	//a finished search hands its place to the next key at once, as paths differ in length
+	static const size_t BatchSearches = 16;
+	static void Prefetch(const void* address)
+	{
+#if defined(_MSC_VER)
+		_mm_prefetch((const char*)address, _MM_HINT_T0);
+#else
+		__builtin_prefetch(address);
+#endif
+	}
+	template <class K> void AccessBatch(Node *root, const K* keys, size_t n, Node** out)
+	{
+		Node* nodes[BatchSearches];
+		Node* candidates[BatchSearches];
+		size_t indices[BatchSearches];
+		size_t next = 0;
+		size_t active = 0;
+		for (; active < BatchSearches && next < n; active++, next++)
+		{
+			nodes[active] = root;
+			candidates[active] = NULL;
+			indices[active] = next;
+		}
+		while (active > 0)
+		{
+			for (size_t i = 0; i < active;)
+			{
+				Node* node = nodes[i];
+				const K& key = keys[indices[i]];
+				if (node != NULL)
+				{
+					if (this->compare(node->GetValue(), key)) node = node->GetRight();
+					else
+					{
+						candidates[i] = node;
+						node = node->GetLeft();
+					}
+					nodes[i] = node;
+					if (node != NULL) Prefetch(node);
+					i++;
+					continue;
+				}
+				Node* candidate = candidates[i];
+				out[indices[i]] = candidate != NULL && !this->compare(key, candidate->GetValue()) ? candidate : NULL;
+				if (next < n)
+				{
+					nodes[i] = root;
+					candidates[i] = NULL;
+					indices[i] = next++;
+					i++;
+				}
+				else
+				{
+					//the last search takes this place
+					active--;
+					nodes[i] = nodes[active];
+					candidates[i] = candidates[active];
+					indices[i] = indices[active];
+				}
 			}
-			if (root->GetParent() != NULL)
+		}
+	}
+	//first node not less than the key
+	template <class K> Node* LowerBound(Node *root, const K& key)
+	{
+		Node* candidate = NULL;
+		RED_BLACK_TREE_COUNT(size_t depth = 0;)
+		while (root != NULL)
+		{
+			RED_BLACK_TREE_COUNT(depth++;)
+			if (this->compare(root->GetValue(), key))
 			{
-				if (root->GetParent()->GetLeft() == root) root->GetParent()->SetLeft(leftmostFromRight);
-				else root->GetParent()->SetRight(leftmostFromRight);
+				root = root->GetRight();
 			}
 			else
 			{
-				this->root = leftmostFromRight;
-				if (this->root != NULL) this->root->ClearParent();
+				candidate = root;
+				root = root->GetLeft();
 			}
-			delete root;
 		}
-		else if(root->GetValue() > value)
+		RED_BLACK_TREE_COUNT(this->sharedStats.AddSearch(depth, depth);)
+		return candidate;
+	}
+	//first node greater than the key
+	template <class K> Node* UpperBound(Node *root, const K& key)
+	{
+		Node* candidate = NULL;
+		while (root != NULL)
 		{
-			if(root->GetLeft() == NULL)
+			if (this->compare(key, root->GetValue()))
 			{
-				//skip
+				candidate = root;
+				root = root->GetLeft();
 			}
 			else
 			{
-				this->DeleteNode(root->GetLeft(), value);
+				root = root->GetRight();
 			}
 		}
-		else
+		return candidate;
+	}
+
+	//OrderStatistics sizes are checked by Validate when the augmentation keeps them
+	static bool SizeMatches(Node *node, size_t size, true_type)
+	{
+		return node->GetAugment().subtreeSize == size;
+	}
+	static bool SizeMatches(Node *, size_t, false_type)
+	{
+		return true;
+	}
+	static size_t SubtreeSize(Node *root)
+	{
+		if (root == NULL) return 0;
+		return root->GetAugment().subtreeSize;
+	}
+	template <class K> size_t RankOf(const K& key)
+	{
+		size_t rank = 0;
+		Node* root = this->root;
+		while (root != NULL)
 		{
-			if(root->GetRight() == NULL)
-			{
-				//skip
-			}
-			else
+			if (this->compare(root->GetValue(), key))
 			{
-				this->DeleteNode(root->GetRight(), value);
+				rank += SubtreeSize(root->GetLeft()) + 1;
+				root = root->GetRight();
 			}
+			else root = root->GetLeft();
 		}
+		return rank;
+	}
+	template <class K> size_t CountRangeOf(const K& low, const K& high)
+	{
+		if (!this->compare(low, high)) return 0;
+		return this->RankOf(high) - this->RankOf(low);
 	}
 
-	//ballancing functionalities: double red problem and insertion
-	void SolveDoubleRedProblem(RBNode<T> *root)
+	template <class A, class K> typename A::Monoid::ValueType AggregateOf(const K& low, const K& high)
 	{
-		//exception black child
-		//if (root->GetLeft() != NULL && !root->GetLeft()->IsRed()
-		//	&& root->GetRight() != NULL && !root->GetRight()->IsRed()) return;
-		//if no double red problem
-		if (root->IsRed() == false) return;
-		//right rotate
-		if (root == root->GetParent()->GetLeft())
+		typedef typename A::Monoid Monoid;
+		typename Monoid::ValueType leftPart = Monoid::Identity();
+		typename Monoid::ValueType rightPart = Monoid::Identity();
+		if (!this->compare(low, high)) return leftPart;
+		//descend to the first node inside the range, where the paths to both bounds split
+		Node* split = this->root;
+		while (split != NULL)
 		{
-			if (root->GetParent()->GetRight() == NULL || !root->GetParent()->GetRight()->IsRed()) this->RightRotate(root);
+			if (this->compare(split->GetValue(), low)) split = split->GetRight();
+			else if (!this->compare(split->GetValue(), high)) split = split->GetLeft();
+			else break;
+		}
+		if (split == NULL) return leftPart;
+		//towards low: every node not less than low brings its right subtree along
+		Node* root = split->GetLeft();
+		while (root != NULL)
+		{
+			if (this->compare(root->GetValue(), low)) root = root->GetRight();
 			else
 			{
-				root->Recolor();
-				root->GetParent()->GetRight()->Recolor();
-				root->GetParent()->Recolor();
-				//case real root is reached
-				if (root->GetParent()->GetParent() == NULL)
-				{
-					root->GetParent()->Recolor();
-					return;
-				}
-				//root is now black so check one level up
-				SolveDoubleRedProblem(root->GetParent()->GetParent());
+				typename Monoid::ValueType part = Monoid::Lift(root->GetValue());
+				if (root->GetRight() != NULL) part = Monoid::Combine(part, root->GetRight()->GetAugment().aggregate);
+				leftPart = Monoid::Combine(part, leftPart);
+				root = root->GetLeft();
 			}
 		}
-		//left rotate
-		else
+		//towards high: every node less than high brings its left subtree along
+		root = split->GetRight();
+		while (root != NULL)
 		{
-			if (root->GetParent()->GetLeft() == NULL || !root->GetParent()->GetLeft()->IsRed()) this->LeftRotate(root);
+			if (!this->compare(root->GetValue(), high)) root = root->GetLeft();
+			else
+			{
+				typename Monoid::ValueType part = Monoid::Lift(root->GetValue());
+				if (root->GetLeft() != NULL) part = Monoid::Combine(root->GetLeft()->GetAugment().aggregate, part);
+				rightPart = Monoid::Combine(rightPart, part);
+				root = root->GetRight();
+			}
+		}
+		return Monoid::Combine(Monoid::Combine(leftPart, Monoid::Lift(split->GetValue())), rightPart);
+	}
+
+	//in-order neighbours found over the parent pointers - no stack needed
+	static Node* Minimum(Node *root)
+	{
+		if (root == NULL) return NULL;
+		while (root->GetLeft() != NULL) root = root->GetLeft();
+		return root;
+	}
+	static Node* Maximum(Node *root)
+	{
+		if (root == NULL) return NULL;
+		while (root->GetRight() != NULL) root = root->GetRight();
+		return root;
+	}
+	static Node* Successor(Node *root)
+	{
+		if (root->GetRight() != NULL) return Minimum(root->GetRight());
+		Node* parent = root->GetParent();
+		while (parent != NULL && root == parent->GetRight())
+		{
+			root = parent;
+			parent = parent->GetParent();
+		}
+		return parent;
+	}
+	static Node* Predecessor(Node *root)
+	{
+		if (root->GetLeft() != NULL) return Maximum(root->GetLeft());
+		Node* parent = root->GetParent();
+		while (parent != NULL && root == parent->GetLeft())
+		{
+			root = parent;
+			parent = parent->GetParent();
+		}
+		return parent;
+	}
+	//regular BST insert: descends to the empty slot where the key belongs
+	//returns the parent of that slot (NULL for an empty tree) or sets equal if the key is already present
+	template <class K> Node* FindSlot(Node *root, const K& key, Node*& equal, bool& left)
+	{
+		Node* parent = NULL;
+		//last node not greater than the key
+		Node* candidate = NULL;
+		equal = NULL;
+		left = false;
+		RED_BLACK_TREE_COUNT(size_t depth = 0;)
+		while (root != NULL)
+		{
+			RED_BLACK_TREE_COUNT(depth++;)
+			parent = root;
+			if (this->compare(key, root->GetValue()))
+			{
+				left = true;
+				root = root->GetLeft();
+			}
+			else
+			{
+				left = false;
+				candidate = root;
+				root = root->GetRight();
+			}
+		}
+		RED_BLACK_TREE_COUNT(this->stats.insertSearches++; this->stats.insertComparisons += depth + (candidate != NULL); this->sharedStats.RecordDepth(depth);)
+		if (candidate != NULL && !this->compare(candidate->GetValue(), key)) equal = candidate;
+		return parent;
+	}
+	void AttachNode(Node *parent, bool left, Node *insertedNode)
+	{
+		if (parent == NULL)
+		{
+			this->root = insertedNode;
+			this->root->Recolor();
+			this->UpdateAugment(insertedNode);
+			return;
+		}
+		if (left) parent->SetLeft(insertedNode);
+		else parent->SetRight(insertedNode);
+		this->UpdatePath(insertedNode);
+		if (this->relaxedBalance)
+		{
+			this->RecordRedPair(insertedNode);
+			return;
+		}
+		//restore uniform black height
+		this->SolveDoubleRedProblem(parent);
+	}
+	//the node is created only once the value is known to be missing
+	template <class V> pair<Node*, bool> InsertUnique(V&& value)
+	{
+		RED_BLACK_TREE_COUNT(RedBlackTreeStats::Timer timer(this->stats.insertLatency);)
+		Node* equal;
+		bool left;
+		Node* parent = this->FindSlot(this->root, value, equal, left);
+		//skip
+		if (equal != NULL) return make_pair(equal, false);
+		Node* insertedNode = this->CreateNode(forward<V>(value));
+		this->AttachNode(parent, left, insertedNode);
+		return make_pair(insertedNode, true);
+	}
+
+	//top-down operations: the tree is fixed on the way down, nothing above the current node is touched afterwards
+	//so a writer coupling locks hand over hand can release everything above the grandparent as it descends
+	static bool IsRedNode(Node *node)
+	{
+		return node != NULL && node->IsRed();
+	}
+	static void Paint(Node *node, bool red)
+	{
+		if (node->IsRed() != red) node->Recolor();
+	}
+	static Node* Child(Node *node, bool right)
+	{
+		return right ? node->GetRight() : node->GetLeft();
+	}
+	//the node goes down on that side, its child from the other side takes its place
+	void RotateDown(Node *node, bool right)
+	{
+		if (right) this->JoinRotateRight(node, this->root);
+		else this->JoinRotateLeft(node, this->root);
+	}
+	//a red node under a red parent: the grandparent is black and so is its other child, as every split above made sure
+	//one or two rotations at the grandparent settle it without going any further up
+	void SplitRedPair(Node *node)
+	{
+		Node* parent = node->GetParent();
+		if (parent == NULL)
+		{
+			node->Recolor();
+			return;
+		}
+		if (!parent->IsRed()) return;
+		Node* grandParent = parent->GetParent();
+		bool parentLeft = grandParent->GetLeft() == parent;
+		Node* top = parent;
+		//inner grandchild: turned outer first
+		if ((parent->GetLeft() == node) != parentLeft)
+		{
+			this->RotateDown(parent, !parentLeft);
+			top = node;
+		}
+		this->RotateDown(grandParent, parentLeft);
+		top->Recolor();
+		grandParent->Recolor();
+		RED_BLACK_TREE_COUNT(this->stats.topDownRotations += top == node ? 2 : 1; this->stats.topDownRecolors += 2;)
+	}
+	//a node with two red children is split on the way down: it takes the red and passes its black to both of them
+	//the slot at the bottom then always hangs under a black node or under a red one a rotation can fix on the spot
+	template <class V> pair<Node*, bool> InsertUniqueTopDown(V&& value)
+	{
+		RED_BLACK_TREE_COUNT(RedBlackTreeStats::Timer timer(this->stats.insertLatency);)
+		this->Rebalance((size_t)-1);
+		Node* node = this->root;
+		Node* parent = NULL;
+		//last node not greater than the value
+		Node* candidate = NULL;
+		bool left = false;
+		RED_BLACK_TREE_COUNT(size_t depth = 0;)
+		while (node != NULL)
+		{
+			RED_BLACK_TREE_COUNT(depth++;)
+			if (IsRedNode(node->GetLeft()) && IsRedNode(node->GetRight()))
+			{
+				node->Recolor();
+				node->GetLeft()->Recolor();
+				node->GetRight()->Recolor();
+				RED_BLACK_TREE_COUNT(this->stats.topDownRecolors += 3;)
+				//after a double rotation the node itself is the top of the fixed subtree, the descent goes on from it
+				this->SplitRedPair(node);
+			}
+			parent = node;
+			if (this->compare(value, node->GetValue()))
+			{
+				left = true;
+				node = node->GetLeft();
+			}
+			else
+			{
+				left = false;
+				candidate = node;
+				node = node->GetRight();
+			}
+		}
+		RED_BLACK_TREE_COUNT(this->stats.insertSearches++; this->stats.insertComparisons += depth + (candidate != NULL); this->sharedStats.RecordDepth(depth);)
+		//the splits on the way are kept, the tree is as valid with them as without
+		if (candidate != NULL && !this->compare(candidate->GetValue(), value)) return make_pair(candidate, false);
+		Node* insertedNode = this->CreateNode(forward<V>(value));
+		if (parent == NULL)
+		{
+			this->AttachNode(NULL, left, insertedNode);
+			return make_pair(insertedNode, true);
+		}
+		if (left) parent->SetLeft(insertedNode);
+		else parent->SetRight(insertedNode);
+		this->UpdatePath(insertedNode);
+		this->SplitRedPair(insertedNode);
+		return make_pair(insertedNode, true);
+	}
+	//the red is pushed down along the search path, so the node finally unlinked is red and nothing has to be rebalanced after
+	//the search goes left on equality and ends at the node of the key when it has no left child, else at its predecessor
+	template <class K> bool RemoveTopDown(const K& key)
+	{
+		RED_BLACK_TREE_COUNT(RedBlackTreeStats::Timer timer(this->stats.deleteLatency);)
+		this->Rebalance((size_t)-1);
+		if (this->root == NULL) return false;
+		Node* node = NULL;
+		Node* next = this->root;
+		Node* parent = NULL;
+		//last node not less than the key
+		Node* candidate = NULL;
+		bool right = true;
+		RED_BLACK_TREE_COUNT(size_t depth = 0;)
+		while (next != NULL)
+		{
+			RED_BLACK_TREE_COUNT(depth++;)
+			bool last = right;
+			parent = node;
+			node = next;
+			right = this->compare(node->GetValue(), key);
+			if (!right) candidate = node;
+			if (!node->IsRed() && !IsRedNode(Child(node, right)))
+			{
+				//the red sibling of the next node comes up, the node goes down red under it
+				if (IsRedNode(Child(node, !right)))
+				{
+					Node* riser = Child(node, !right);
+					this->RotateDown(node, right);
+					riser->Recolor();
+					node->Recolor();
+					RED_BLACK_TREE_COUNT(this->stats.topDownRotations++; this->stats.topDownRecolors += 2;)
+				}
+				//both children black: the red comes from the parent, red itself unless the node is the root
+				else if (parent != NULL)
+				{
+					Node* sibling = Child(parent, !last);
+					if (sibling != NULL)
+					{
+						if (!IsRedNode(sibling->GetLeft()) && !IsRedNode(sibling->GetRight()))
+						{
+							parent->Recolor();
+							sibling->Recolor();
+							node->Recolor();
+							RED_BLACK_TREE_COUNT(this->stats.topDownRecolors += 3;)
+						}
+						else
+						{
+							//a red nephew: the sibling's subtree lends a node to the side of the node
+							Node* top = sibling;
+							if (IsRedNode(Child(sibling, last)))
+							{
+								top = Child(sibling, last);
+								this->RotateDown(sibling, !last);
+							}
+							this->RotateDown(parent, last);
+							Paint(top, true);
+							Paint(top->GetLeft(), false);
+							Paint(top->GetRight(), false);
+							Paint(node, true);
+							RED_BLACK_TREE_COUNT(this->stats.topDownRotations += top == sibling ? 1 : 2; this->stats.topDownRecolors += 4;)
+						}
+					}
+				}
+			}
+			next = Child(node, right);
+		}
+		RED_BLACK_TREE_COUNT(this->sharedStats.AddSearch(depth + (candidate != NULL), depth);)
+		if (candidate == NULL || this->compare(key, candidate->GetValue()))
+		{
+			Paint(this->root, false);
+			return false;
+		}
+		//node is the candidate or its predecessor, and has one child at most
+		Node* removed = candidate;
+		Node* child = node->GetLeft() != NULL ? node->GetLeft() : node->GetRight();
+		parent = node->GetParent();
+		if (parent == NULL)
+		{
+			this->root = child;
+			if (child != NULL) child->ClearParent();
+		}
+		else if (parent->GetLeft() == node) parent->SetLeft(child);
+		else parent->SetRight(child);
+		Node* updateFrom = parent;
+		//the predecessor takes the place of the removed node
+		if (node != removed)
+		{
+			if (updateFrom == removed) updateFrom = node;
+			Node* removedParent = removed->GetParent();
+			node->SetLeft(removed->GetLeft());
+			node->SetRight(removed->GetRight());
+			Paint(node, removed->IsRed());
+			if (removedParent == NULL)
+			{
+				this->root = node;
+				node->ClearParent();
+			}
+			else if (removedParent->GetLeft() == removed) removedParent->SetLeft(node);
+			else removedParent->SetRight(node);
+		}
+		if (updateFrom != NULL) this->UpdatePath(updateFrom);
+		this->DestroyNode(removed);
+		if (this->root != NULL) Paint(this->root, false);
+		return true;
+	}
+
+	//relaxed balance: see SetRelaxedBalance
+	//the weight of a node is 0 when red, 1 when black plus its extra blackness, and every path from the root weighs the same
+	//the repairs below keep those sums while they move a violation up or settle it with rotations, in any order
+	void Enqueue(Node *node)
+	{
+		if (node->IsQueued()) return;
+		node->SetQueued(true);
+		this->rebalanceQueue.push_back(node);
+	}
+	//only the root is in the tree without a parent
+	bool IsDeleted(Node *node)
+	{
+		return node->GetParent() == NULL && node != this->root;
+	}
+	void RecordRedPair(Node *node)
+	{
+		if (IsRedNode(node) && IsRedNode(node->GetParent())) this->Enqueue(node);
+	}
+	static bool UnrecordedRed(Node *node)
+	{
+		return IsRedNode(node) && !node->IsQueued();
+	}
+	size_t ExtraBlackness(Node *node)
+	{
+		if (!node->IsQueued() || this->extraBlackness.empty()) return 0;
+		typename unordered_map<Node*, size_t>::iterator found = this->extraBlackness.find(node);
+		return found == this->extraBlackness.end() ? 0 : found->second;
+	}
+	//the root takes or gives blackness freely, every path changes alike
+	void AddBlackness(Node *node, size_t weight)
+	{
+		if (node->GetParent() == NULL)
+		{
+			Paint(node, false);
+			return;
+		}
+		if (node->IsRed())
+		{
+			node->Recolor();
+			weight--;
+		}
+		if (weight == 0) return;
+		this->extraBlackness[node] += weight;
+		this->Enqueue(node);
+	}
+	//the node is black
+	void TakeBlackness(Node *node)
+	{
+		if (this->ExtraBlackness(node) > 0)
+		{
+			typename unordered_map<Node*, size_t>::iterator found = this->extraBlackness.find(node);
+			if (--found->second == 0) this->extraBlackness.erase(found);
+			return;
+		}
+		if (node->GetParent() == NULL) return;
+		node->Recolor();
+		this->RecordRedPair(node);
+		this->RecordRedPair(node->GetLeft());
+		this->RecordRedPair(node->GetRight());
+	}
+	//after a rotation the new top of the subtree stands in for the old one: it takes its color and extra blackness,
+	//the old one is left plain black
+	void StandIn(Node *top, Node *old)
+	{
+		Paint(top, old->IsRed());
+		Paint(old, false);
+		size_t extra = this->ExtraBlackness(old);
+		if (extra > 0)
+		{
+			this->extraBlackness.erase(old);
+			this->extraBlackness[top] = extra;
+			this->Enqueue(top);
+		}
+		this->RecordRedPair(top);
+	}
+	//a red node under a red parent: a red-red pair further up goes first, as the grandparent has to be black
+	void SolveRedViolation(Node *node)
+	{
+		if (!IsRedNode(node) || !IsRedNode(node->GetParent())) return;
+		Node* parent = node->GetParent();
+		Node* grandParent = parent->GetParent();
+		while (grandParent != NULL && grandParent->IsRed())
+		{
+			this->Enqueue(node);
+			node = parent;
+			parent = grandParent;
+			grandParent = grandParent->GetParent();
+		}
+		if (grandParent == NULL)
+		{
+			parent->Recolor();
+			return;
+		}
+		bool parentLeft = grandParent->GetLeft() == parent;
+		Node* uncle = Child(grandParent, parentLeft);
+		//the grandparent hands one unit of its weight down to both children
+		if (IsRedNode(uncle))
+		{
+			parent->Recolor();
+			uncle->Recolor();
+			this->TakeBlackness(grandParent);
+			return;
+		}
+		Node* top = parent;
+		if ((parent->GetLeft() == node) != parentLeft)
+		{
+			this->RotateDown(parent, !parentLeft);
+			top = node;
+		}
+		this->RotateDown(grandParent, parentLeft);
+		this->StandIn(top, grandParent);
+		grandParent->Recolor();
+		this->RecordRedPair(grandParent->GetLeft());
+		this->RecordRedPair(grandParent->GetRight());
+		if (top == node)
+		{
+			this->RecordRedPair(parent->GetLeft());
+			this->RecordRedPair(parent->GetRight());
+		}
+	}
+	//one unit of blackness missing on that side of the parent, where the child is missing or carries it as extra blackness
+	//the sibling cannot be missing, its paths weigh at least as much; every case makes up exactly one unit:
+	//pushed up into the parent, or settled by at most two rotations on the spot
+	void ReduceDeficit(Node *parent, bool right)
+	{
+		while (true)
+		{
+			Node* sibling = Child(parent, !right);
+			Node* inner = Child(sibling, right);
+			Node* outer = Child(sibling, !right);
+			if (sibling->IsRed())
+			{
+				//a red-red pair next to the deficit is turned until the sibling has a non-red inner child
+				if (IsRedNode(inner))
+				{
+					this->RotateDown(sibling, !right);
+					this->RecordRedPair(sibling);
+					this->RecordRedPair(inner);
+					continue;
+				}
+				//the parent comes down black onto the deficit, the inner child gives up as much for its paths
+				this->RotateDown(parent, right);
+				this->StandIn(sibling, parent);
+				this->TakeBlackness(inner);
+			}
+			else if (this->ExtraBlackness(sibling) > 0)
+			{
+				this->TakeBlackness(sibling);
+				this->AddBlackness(parent, 1);
+			}
+			else if (IsRedNode(outer))
+			{
+				this->RotateDown(parent, right);
+				this->StandIn(sibling, parent);
+				outer->Recolor();
+			}
+			else if (IsRedNode(inner))
+			{
+				this->RotateDown(sibling, !right);
+				this->RotateDown(parent, right);
+				this->StandIn(inner, parent);
+			}
+			else
+			{
+				sibling->Recolor();
+				this->AddBlackness(parent, 1);
+			}
+			return;
+		}
+	}
+	//the node is unlinked as from a plain search tree, its successor taking its place when it has two children
+	//the weight of whatever left the tree goes to the child taking its place, or is made up at once where none does
+	void RemoveRelaxed(Node *node)
+	{
+		Node* unlinked = node;
+		if (node->GetLeft() != NULL && node->GetRight() != NULL) unlinked = Minimum(node->GetRight());
+		size_t weight = (unlinked->IsRed() ? 0 : 1) + this->ExtraBlackness(unlinked);
+		if (weight > 1) this->extraBlackness.erase(unlinked);
+		Node* child = unlinked->GetLeft() != NULL ? unlinked->GetLeft() : unlinked->GetRight();
+		Node* parent = unlinked->GetParent();
+		bool right = parent != NULL && parent->GetRight() == unlinked;
+		if (parent == NULL)
+		{
+			this->root = child;
+			if (child != NULL) child->ClearParent();
+		}
+		else if (right) parent->SetRight(child);
+		else parent->SetLeft(child);
+		if (unlinked != node)
+		{
+			if (parent == node) parent = unlinked;
+			Node* nodeParent = node->GetParent();
+			unlinked->SetLeft(node->GetLeft());
+			unlinked->SetRight(node->GetRight());
+			if (nodeParent == NULL)
+			{
+				this->root = unlinked;
+				unlinked->ClearParent();
+			}
+			else if (nodeParent->GetLeft() == node) nodeParent->SetLeft(unlinked);
+			else nodeParent->SetRight(unlinked);
+			this->StandIn(unlinked, node);
+		}
+		if (parent != NULL) this->UpdatePath(parent);
+		if (node->IsQueued())
+		{
+			this->extraBlackness.erase(node);
+			Isolate(node);
+		}
+		else this->DestroyNode(node);
+		if (weight == 0) this->RecordRedPair(child);
+		else if (child != NULL) this->AddBlackness(child, weight);
+		else if (parent != NULL) for (; weight > 0; weight--) this->ReduceDeficit(parent, right);
+	}
+
+	//batch operations: sorted keys are handled with finger search or, against a small tree, a merge that relinks all nodes
+	//measured crossovers: an insert batch merges when the tree is under a quarter of it, a delete batch under twice it
+	bool PrefersMerge(size_t treeLimit)
+	{
+		return this->CountUpTo(treeLimit) < treeLimit;
+	}
+	//sorted with repeated keys dropped - the first of them is kept as a one by one insert would do
+	void SortBatch(vector<T>& batch)
+	{
+		Compare compare = this->compare;
+		stable_sort(batch.begin(), batch.end(), compare);
+		batch.erase(unique(batch.begin(), batch.end(), [&compare](const T& a, const T& b) { return !compare(a, b); }), batch.end());
+	}
+	//counts the nodes but stops at limit, so deciding on a merge never costs more than the batch itself
+	size_t CountUpTo(size_t limit)
+	{
+		size_t count = 0;
+		for (Node* node = Minimum(this->root); node != NULL && count < limit; node = Successor(node)) count++;
+		return count;
+	}
+	//the values of a detached subtree are moved out in order - its nodes are released right after
+	void ExtractSorted(Node *root, vector<T>& values)
+	{
+		for (Node* node = Minimum(root); node != NULL; node = Successor(node)) values.push_back(move(const_cast<T&>(node->GetValue())));
+	}
+	//a merge relinks the nodes themselves, so the nodes of values that stay keep their place in memory
+	void CollectSorted(vector<Node*>& nodes)
+	{
+		for (Node* node = Minimum(this->root); node != NULL; node = Successor(node)) nodes.push_back(node);
+	}
+	//sorted nodes of any shape and color become a perfectly balanced tree, as the new ones of BuildFromSorted do
+	void RelinkSorted(vector<Node*>& nodes)
+	{
+		this->root = NULL;
+		if (nodes.empty()) return;
+		for (size_t i = 0; i < nodes.size(); i++) Paint(nodes[i], true);
+		this->root = this->LinkSorted(nodes.data(), 0, nodes.size(), 0, RedDepth(nodes.size()));
+		this->root->ClearParent();
+	}
+	//a finger chains every search to the previous one, which only pays off when the keys lie close together
+	//the tree size is estimated from the depth of one descent, a batch counts as dense with a key per few nodes
+	bool IsDenseBatch(const T& key, size_t batchSize)
+	{
+		size_t depth = 0;
+		for (Node* node = this->root; node != NULL; node = this->compare(key, node->GetValue()) ? node->GetLeft() : node->GetRight()) depth++;
+		return depth < 8 * sizeof(size_t) && ((size_t)1 << depth) <= 8 * batchSize;
+	}
+	//finger search: climbs from a node less than the key to the lowest subtree whose range holds the key
+	//bound is the ancestor right above that range, the descent from the returned node never has to leave it
+	template <class K> Node* FingerStart(Node *finger, const K& key, Node*& bound)
+	{
+		bound = NULL;
+		if (finger == NULL) return this->root;
+		while (finger->GetParent() != NULL)
+		{
+			Node* parent = finger->GetParent();
+			if (finger == parent->GetLeft() && this->compare(key, parent->GetValue()))
+			{
+				bound = parent;
+				return finger;
+			}
+			finger = parent;
+		}
+		return finger;
+	}
+	void RemoveNode(Node *root)
+	{
+		if (this->relaxedBalance)
+		{
+			this->RemoveRelaxed(root);
+			return;
+		}
+		Node *leftmostFromRight;
+		Node *updateFrom;
+		if (root->GetLeft() == NULL) leftmostFromRight = root->GetRight();
+		else if (root->GetRight() == NULL) leftmostFromRight = root->GetLeft();
+		else if (root->GetLeft()->GetRight() == NULL) leftmostFromRight = root->GetLeft();
+		else if (root->GetRight()->GetLeft() == NULL) leftmostFromRight = root->GetRight();
+		//symmetrical after the four exceptional cases above - left implemented
+		else
+		{
+			leftmostFromRight = root->GetRight()->GetLeft();
+			while (leftmostFromRight->GetLeft() != NULL)
+			{
+				leftmostFromRight = leftmostFromRight->GetLeft();
+			}
+		}			
+		if (leftmostFromRight == NULL)
+		{
+			//reballance by checking for red-black tree deletion preliminaries in both cases
+			if (root->GetLeft() != NULL) root->GetLeft()->Recolor(); 
+			else if (root->GetRight() != NULL) root->GetRight()->Recolor();
+			//this case is possible only if (leftmostFromRight != root->GetLeft() && root->GetLeft() != NULL)
+			else if (!root->IsRed()) RestoreReducedHeight(root);
+			updateFrom = root->GetParent();
+		}
+		else
+		{
+			//leftmostFromRight is always black and its single child is always red - first condition is possible bacause of the four exceptional cases
+			if (leftmostFromRight->GetLeft() != NULL) leftmostFromRight->GetLeft()->Recolor(); 
+			else if (leftmostFromRight->GetRight() != NULL) leftmostFromRight->GetRight()->Recolor();
+			//this case is possible only if (leftmostFromRight != root->GetLeft() && root->GetLeft() != NULL)
+			else if (!leftmostFromRight->IsRed()) RestoreReducedHeight(leftmostFromRight);
+			//the node leftmostFromRight is taken from lost a child
+			if (leftmostFromRight->GetParent() == root) updateFrom = leftmostFromRight;
+			else updateFrom = leftmostFromRight->GetParent();
+			if (leftmostFromRight != root->GetLeft() && leftmostFromRight != root->GetRight()) leftmostFromRight->GetParent()->SetLeft(leftmostFromRight->GetRight());
+
+			//replace with originally removed node
+			//include the above cases where leftmost is child of the root
+			if (leftmostFromRight != root->GetLeft() && root->GetLeft() != NULL) leftmostFromRight->SetLeft(root->GetLeft());
+			if (leftmostFromRight != root->GetRight() && root->GetRight() != NULL) leftmostFromRight->SetRight(root->GetRight());
+			//recolor if necessary
+			if (root->IsRed() && !leftmostFromRight->IsRed()) leftmostFromRight->Recolor();
+			if (!root->IsRed() && leftmostFromRight->IsRed()) leftmostFromRight->Recolor();
+		}
+		if (root->GetParent() != NULL)
+		{
+			if (root->GetParent()->GetLeft() == root) root->GetParent()->SetLeft(leftmostFromRight);
+			else root->GetParent()->SetRight(leftmostFromRight);
+		}
+		else
+		{
+			this->root = leftmostFromRight;
+			if (this->root != NULL) this->root->ClearParent();
+		}
+		this->UpdatePath(updateFrom);
+		this->DestroyNode(root);
+	}
+
+	//join and split (inner implementation)
+	//a detached subtree root with its black height, so joins never have to measure it again
+	struct Subtree
+	{
+		Node* root;
+		size_t blackHeight;
+		Subtree(Node* root = NULL, size_t blackHeight = 0) : root(root), blackHeight(blackHeight)
+		{
+		}
+	};
+	//black nodes on every path from the node down to a leaf, the node itself included
+	static size_t BlackHeightOf(Node *root)
+	{
+		size_t blackHeight = 0;
+		for (; root != NULL; root = root->GetLeft()) if (!root->IsRed()) blackHeight++;
+		return blackHeight;
+	}
+	static size_t ChildBlackHeight(Node *root, size_t blackHeight)
+	{
+		return root->IsRed() ? blackHeight : blackHeight - 1;
+	}
+	//cuts the subtree off its parent - a red root can always be painted black
+	static Subtree Detached(Subtree tree)
+	{
+		if (tree.root == NULL) return tree;
+		tree.root->ClearParent();
+		if (tree.root->IsRed())
+		{
+			tree.root->Recolor();
+			tree.blackHeight++;
+		}
+		return tree;
+	}
+	static void Isolate(Node *node)
+	{
+		node->SetLeft(NULL);
+		node->SetRight(NULL);
+		node->ClearParent();
+	}
+	//single rotations for the joins, where the subtree root is held in a local instead of this->root
+	void JoinRotateLeft(Node *node, Node*& root)
+	{
+		Node* child = node->GetRight();
+		Node* parent = node->GetParent();
+		node->SetRight(child->GetLeft());
+		if (parent == NULL)
+		{
+			root = child;
+			child->ClearParent();
+		}
+		else if (parent->GetLeft() == node) parent->SetLeft(child);
+		else parent->SetRight(child);
+		child->SetLeft(node);
+		this->UpdateRotated(child);
+	}
+	void JoinRotateRight(Node *node, Node*& root)
+	{
+		Node* child = node->GetLeft();
+		Node* parent = node->GetParent();
+		node->SetLeft(child->GetRight());
+		if (parent == NULL)
+		{
+			root = child;
+			child->ClearParent();
+		}
+		else if (parent->GetLeft() == node) parent->SetLeft(child);
+		else parent->SetRight(child);
+		child->SetRight(node);
+		this->UpdateRotated(child);
+	}
+	//every value of left is less than the pivot and every value of right greater, O(|difference of black heights| + 1)
+	//joins touch nothing but the given nodes, so independent joins may run on different threads
+	Subtree JoinNodes(Subtree left, Node *pivot, Subtree right)
+	{
+		left = Detached(left);
+		right = Detached(right);
+		if (!pivot->IsRed()) pivot->Recolor();
+		pivot->ClearParent();
+		if (left.blackHeight > right.blackHeight) return this->JoinRight(left, pivot, right);
+		if (left.blackHeight < right.blackHeight) return this->JoinLeft(left, pivot, right);
+		pivot->SetLeft(left.root);
+		pivot->SetRight(right.root);
+		pivot->Recolor();
+		this->UpdateAugment(pivot);
+		return Subtree(pivot, left.blackHeight + 1);
+	}
+	//the shorter right tree hangs under the pivot at the first black node of the left tree's right spine as high as it
+	//the red pivot is then fixed like an inserted node - always a right-right case on the spine
+	Subtree JoinRight(Subtree left, Node *pivot, Subtree right)
+	{
+		Node* root = left.root;
+		Node* parent = NULL;
+		Node* node = root;
+		size_t blackHeight = left.blackHeight;
+		while (node != NULL && (node->IsRed() || blackHeight != right.blackHeight))
+		{
+			if (!node->IsRed()) blackHeight--;
+			parent = node;
+			node = node->GetRight();
+		}
+		pivot->SetLeft(node);
+		pivot->SetRight(right.root);
+		parent->SetRight(pivot);
+		this->UpdatePath(pivot);
+		bool grown = false;
+		Node* child = pivot;
+		while (child->GetParent()->IsRed())
+		{
+			parent = child->GetParent();
+			Node* grandParent = parent->GetParent();
+			Node* uncle = grandParent->GetLeft();
+			if (uncle != NULL && uncle->IsRed())
+			{
+				parent->Recolor();
+				uncle->Recolor();
+				grandParent->Recolor();
+				//case real root is reached
+				if (grandParent->GetParent() == NULL)
+				{
+					grandParent->Recolor();
+					grown = true;
+					break;
+				}
+				child = grandParent;
+			}
+			else
+			{
+				parent->Recolor();
+				grandParent->Recolor();
+				this->JoinRotateLeft(grandParent, root);
+				break;
+			}
+		}
+		return Subtree(root, left.blackHeight + (grown ? 1 : 0));
+	}
+	Subtree JoinLeft(Subtree left, Node *pivot, Subtree right)
+	{
+		Node* root = right.root;
+		Node* parent = NULL;
+		Node* node = root;
+		size_t blackHeight = right.blackHeight;
+		while (node != NULL && (node->IsRed() || blackHeight != left.blackHeight))
+		{
+			if (!node->IsRed()) blackHeight--;
+			parent = node;
+			node = node->GetLeft();
+		}
+		pivot->SetRight(node);
+		pivot->SetLeft(left.root);
+		parent->SetLeft(pivot);
+		this->UpdatePath(pivot);
+		bool grown = false;
+		Node* child = pivot;
+		while (child->GetParent()->IsRed())
+		{
+			parent = child->GetParent();
+			Node* grandParent = parent->GetParent();
+			Node* uncle = grandParent->GetRight();
+			if (uncle != NULL && uncle->IsRed())
+			{
+				parent->Recolor();
+				uncle->Recolor();
+				grandParent->Recolor();
+				//case real root is reached
+				if (grandParent->GetParent() == NULL)
+				{
+					grandParent->Recolor();
+					grown = true;
+					break;
+				}
+				child = grandParent;
+			}
+			else
+			{
+				parent->Recolor();
+				grandParent->Recolor();
+				this->JoinRotateRight(grandParent, root);
+				break;
+			}
+		}
+		return Subtree(root, right.blackHeight + (grown ? 1 : 0));
+	}
+	//deepest possible search path of a red-black tree that fits in memory
+	static const size_t MaxPathLength = 2 * 8 * sizeof(size_t);
+	//values less than the key go to left, greater ones to right and the node equal to it is returned isolated
+	//the pieces hanging off the search path are joined bottom-up, the join costs add up to O(log n)
+	template <class K> Node* SplitNodes(Subtree tree, const K& key, Subtree& left, Subtree& right)
+	{
+		//plain arrays on the stack - a split is far too short for a heap allocation
+		Node* path[MaxPathLength];
+		size_t heights[MaxPathLength];
+		bool wentLeft[MaxPathLength];
+		size_t length = 0;
+		Node* equal = NULL;
+		left = right = Subtree();
+		while (tree.root != NULL)
+		{
+			Node* node = tree.root;
+			size_t childHeight = ChildBlackHeight(node, tree.blackHeight);
+			if (this->compare(key, node->GetValue()))
+			{
+				path[length] = node;
+				heights[length] = tree.blackHeight;
+				wentLeft[length++] = true;
+				tree = Subtree(node->GetLeft(), childHeight);
+			}
+			else if (this->compare(node->GetValue(), key))
+			{
+				path[length] = node;
+				heights[length] = tree.blackHeight;
+				wentLeft[length++] = false;
+				tree = Subtree(node->GetRight(), childHeight);
+			}
+			else
+			{
+				equal = node;
+				left = Subtree(node->GetLeft(), childHeight);
+				right = Subtree(node->GetRight(), childHeight);
+				break;
+			}
+		}
+		while (length > 0)
+		{
+			length--;
+			Node* node = path[length];
+			size_t childHeight = ChildBlackHeight(node, heights[length]);
+			if (wentLeft[length]) right = this->JoinNodes(right, node, Subtree(node->GetRight(), childHeight));
+			else left = this->JoinNodes(Subtree(node->GetLeft(), childHeight), node, left);
+		}
+		if (equal != NULL) Isolate(equal);
+		return equal;
+	}
+	//takes the greatest node out, rest keeps all the others
+	Node* SplitLast(Subtree tree, Subtree& rest)
+	{
+		Node* path[MaxPathLength];
+		size_t heights[MaxPathLength];
+		size_t length = 0;
+		while (tree.root->GetRight() != NULL)
+		{
+			path[length] = tree.root;
+			heights[length++] = tree.blackHeight;
+			tree = Subtree(tree.root->GetRight(), ChildBlackHeight(tree.root, tree.blackHeight));
+		}
+		Node* last = tree.root;
+		rest = Subtree(last->GetLeft(), ChildBlackHeight(last, tree.blackHeight));
+		while (length > 0)
+		{
+			length--;
+			Node* node = path[length];
+			rest = this->JoinNodes(Subtree(node->GetLeft(), ChildBlackHeight(node, heights[length])), node, rest);
+		}
+		Isolate(last);
+		return last;
+	}
+	//join without a pivot - the greatest node of left becomes it
+	Subtree ConcatenateNodes(Subtree left, Subtree right)
+	{
+		if (left.root == NULL) return right;
+		if (right.root == NULL) return left;
+		Subtree rest;
+		Node* last = this->SplitLast(left, rest);
+		return this->JoinNodes(rest, last, right);
+	}
+
+	//set operations by split and join in O(m log(n/m + 1)) for sizes m <= n (Blelloch, Ferizovic and Sun)
+	//the root of b splits a, both halves are solved independently and joined again around it
+	//b is only read by intersection and difference, union links its nodes into the result
+	enum SetOperationKind
+	{
+		UnionOperation,
+		IntersectionOperation,
+		DifferenceOperation
+	};
+	//both halves are solved on their own threads while both inputs are this large and cores are left
+	static const size_t ForkBlackHeight = 10;
+	static int ForkDepth()
+	{
+		int depth = 0;
+		while (((unsigned)1 << depth) < thread::hardware_concurrency()) depth++;
+		return depth;
+	}
+	//nodes that drop out are collected as subtree roots and destroyed after all threads are done
+	Subtree SetOperationNodes(SetOperationKind operation, Subtree a, Subtree b, vector<Node*>& discarded, int forkDepth)
+	{
+		if (a.root == NULL) return operation == UnionOperation ? b : a;
+		if (b.root == NULL)
+		{
+			if (operation != IntersectionOperation) return a;
+			discarded.push_back(a.root);
+			return b;
+		}
+		Node* pivot = b.root;
+		size_t childHeight = ChildBlackHeight(pivot, b.blackHeight);
+		Subtree bLeft(pivot->GetLeft(), childHeight);
+		Subtree bRight(pivot->GetRight(), childHeight);
+		Subtree aLeft, aRight;
+		Node* equal = this->SplitNodes(a, pivot->GetValue(), aLeft, aRight);
+		Subtree left, right;
+		if (forkDepth > 0 && a.blackHeight >= ForkBlackHeight && b.blackHeight >= ForkBlackHeight)
+		{
+			vector<Node*> leftDiscarded;
+			future<Subtree> leftTask = async(launch::async, [&]()
+			{
+				return this->SetOperationNodes(operation, aLeft, bLeft, leftDiscarded, forkDepth - 1);
+			});
+			right = this->SetOperationNodes(operation, aRight, bRight, discarded, forkDepth - 1);
+			left = leftTask.get();
+			discarded.insert(discarded.end(), leftDiscarded.begin(), leftDiscarded.end());
+		}
+		else
+		{
+			left = this->SetOperationNodes(operation, aLeft, bLeft, discarded, 0);
+			right = this->SetOperationNodes(operation, aRight, bRight, discarded, 0);
+		}
+		if (operation == UnionOperation)
+		{
+			//the value already in this tree stays, the other one is dropped
+			if (equal != NULL)
+			{
+				Isolate(pivot);
+				discarded.push_back(pivot);
+				pivot = equal;
+			}
+			return this->JoinNodes(left, pivot, right);
+		}
+		if (operation == IntersectionOperation && equal != NULL) return this->JoinNodes(left, equal, right);
+		if (equal != NULL) discarded.push_back(equal);
+		return this->ConcatenateNodes(left, right);
+	}
+	//all nodes of the other tree move into this one: as they are when either allocator can free the other's nodes
+	//otherwise their values are moved into new nodes in O(n)
+	Subtree TakeTree(RedBlackTree& other)
+	{
+		other.Rebalance((size_t)-1);
+		Subtree tree(other.root, BlackHeightOf(other.root));
+		other.root = NULL;
+		if (&other == this || this->nodeAllocator == other.nodeAllocator)
+		{
+			this->ShareBlocks(other);
+			return tree;
+		}
+		vector<T> values;
+		other.ExtractSorted(tree.root, values);
+		other.root = tree.root;
+		other.ReleaseAll();
+		vector<Node*> nodes(values.size());
+		for (size_t i = 0; i < values.size(); i++) nodes[i] = this->CreateNode(move(values[i]));
+		if (nodes.empty()) return Subtree();
+		Node* root = this->LinkSorted(nodes.data(), 0, nodes.size(), 0, RedDepth(nodes.size()));
+		root->ClearParent();
+		return Subtree(root, BlackHeightOf(root));
+	}
+	//the counterpart of TakeTree: the subtree becomes the whole content of the other tree
+	void HandOver(Subtree tree, RedBlackTree& other)
+	{
+		tree = Detached(tree);
+		if (this->nodeAllocator == other.nodeAllocator)
+		{
+			other.root = tree.root;
+			other.ShareBlocks(*this);
+			return;
+		}
+		vector<T> values;
+		this->ExtractSorted(tree.root, values);
+		this->DestroySubtree(tree.root);
+		other.BuildFromSorted(make_move_iterator(values.begin()), make_move_iterator(values.end()));
+	}
+	//nodes for sorted values in one contiguous block, linked into a detached subtree
+	//values not greater than the previous one are skipped, the first one is compared with the given node if there is one
+	template <class ForwardIterator> Subtree BuildSorted(ForwardIterator first, ForwardIterator last, Node* previous)
+	{
+		size_t count = (size_t)distance(first, last);
+		if (count == 0) return Subtree();
+		Node* nodes = NodeAllocatorTraits::allocate(this->nodeAllocator, count);
+		this->AddBlock(nodes, count);
+		size_t used = 0;
+		for (; first != last; ++first)
+		{
+			if (used > 0) previous = nodes + used - 1;
+			if (previous != NULL && !this->compare(previous->GetValue(), *first)) continue;
+			NodeAllocatorTraits::construct(this->nodeAllocator, nodes + used, *first);
+			used++;
+		}
+		for (size_t i = count; i > used; i--) this->PushBulkFree(nodes + i - 1);
+		if (used == 0) return Subtree();
+		Node* root = this->LinkSorted(nodes, 0, used, 0, RedDepth(used));
+		root->ClearParent();
+		return Subtree(root, BlackHeightOf(root));
+	}
+	void SetRoot(Subtree tree)
+	{
+		this->root = Detached(tree).root;
+	}
+
+	template <class K> void SplitAt(const K& key, RedBlackTree& right)
+	{
+		right.ReleaseAll();
+		Subtree leftTree, rightTree;
+		Node* equal = this->SplitNodes(Subtree(this->root, this->BlackHeight()), key, leftTree, rightTree);
+		if (equal != NULL) rightTree = this->JoinNodes(Subtree(), equal, rightTree);
+		this->SetRoot(leftTree);
+		this->HandOver(rightTree, right);
+	}
+	void RunSetOperation(SetOperationKind operation, Subtree other)
+	{
+		vector<Node*> discarded;
+		Subtree tree(this->root, this->BlackHeight());
+		this->root = NULL;
+		this->SetRoot(this->SetOperationNodes(operation, tree, other, discarded, ForkDepth()));
+		for (size_t i = 0; i < discarded.size(); i++) this->DestroySubtree(discarded[i]);
+	}
+
+	//ballancing functionalities: double red problem and insertion
+	void SolveDoubleRedProblem(Node *root)
+	{
+		//exception black child
+		//if (root->GetLeft() != NULL && !root->GetLeft()->IsRed()
+		//	&& root->GetRight() != NULL && !root->GetRight()->IsRed()) return;
+		//if no double red problem
+		while (root->IsRed())
+		{
+			//right rotate
+			if (root == root->GetParent()->GetLeft())
+			{
+				if (root->GetParent()->GetRight() == NULL || !root->GetParent()->GetRight()->IsRed())
+				{
+					this->RightRotate(root);
+					return;
+				}
+				root->Recolor();
+				root->GetParent()->GetRight()->Recolor();
+				root->GetParent()->Recolor();
+				RED_BLACK_TREE_COUNT(this->stats.doubleRedRecolors += 3;)
+			}
+			//left rotate
 			else
 			{
-				root->Recolor();
-				root->GetParent()->GetLeft()->Recolor();
-				root->GetParent()->Recolor();
-				//case real root is reached
-				if (root->GetParent()->GetParent() == NULL)
+				if (root->GetParent()->GetLeft() == NULL || !root->GetParent()->GetLeft()->IsRed())
 				{
-					root->GetParent()->Recolor();
+					this->LeftRotate(root);
 					return;
 				}
-				//root is now black so check one level up
-				SolveDoubleRedProblem(root->GetParent()->GetParent());
+				root->Recolor();
+				root->GetParent()->GetLeft()->Recolor();
+				root->GetParent()->Recolor();
+				RED_BLACK_TREE_COUNT(this->stats.doubleRedRecolors += 3;)
+			}
+			//case real root is reached
+			if (root->GetParent()->GetParent() == NULL)
+			{
+				root->GetParent()->Recolor();
+				RED_BLACK_TREE_COUNT(this->stats.doubleRedRecolors++;)
+				return;
 			}
+			//root is now black so check one level up
+			root = root->GetParent()->GetParent();
 		}
 	}
-	void LeftRotate(RBNode<T> *root)
+	void LeftRotate(Node *root)
 	{
-		RBNode<T> *parent = root->GetParent();
+		RED_BLACK_TREE_COUNT(this->stats.rotations[RedBlackTreeStats::LeftRotation]++;)
+		Node *parent = root->GetParent();
 		//avl similar case 2 for left rotation - double rotation
 		if (root->GetLeft() != NULL && root->GetLeft()->IsRed())
 		{
-			RBNode<T> *badChild = root->GetLeft();
+			Node *badChild = root->GetLeft();
 			root->SetLeft(badChild->GetRight());
 			badChild->SetRight(root);
 			parent->SetRight(badChild);
@@ -300,14 +2047,16 @@ private:
 		}
 		//root's left -> parent
 		root->SetLeft(parent);
+		this->UpdateRotated(root);
 	}
-	void RightRotate(RBNode<T> *root)
+	void RightRotate(Node *root)
 	{
-		RBNode<T> *parent = root->GetParent();
+		RED_BLACK_TREE_COUNT(this->stats.rotations[RedBlackTreeStats::RightRotation]++;)
+		Node *parent = root->GetParent();
 		//avl similar case 2 for right rotation - double rotation
 		if (root->GetRight() != NULL && root->GetRight()->IsRed())
 		{
-			RBNode<T> *badChild = root->GetRight();
+			Node *badChild = root->GetRight();
 			root->SetRight(badChild->GetLeft());
 			badChild->SetLeft(root);
 			parent->SetLeft(badChild);
@@ -333,129 +2082,141 @@ private:
 		}
 		//root's right -> parent
 		root->SetRight(parent);
+		this->UpdateRotated(root);
 	}
 	//ballancing functionalities: reduced height problem and deletion
-	void RestoreReducedHeight(RBNode<T> *root)
+	void RestoreReducedHeight(Node *root)
 	{
-		RBNode<T>* parent = root->GetParent();
-		if (parent == NULL) return;
-		//double cases because of symmetries
-		if (root == parent->GetLeft())
+		//only case 2.2.2 pushes the reduced height one level up
+		while (root->GetParent() != NULL)
 		{
-			if (parent->IsRed())
-			{
-				//first two cases
-				if ((parent->GetRight()->GetLeft() != NULL && parent->GetRight()->GetLeft()->IsRed())
-					|| (parent->GetRight()->GetRight() != NULL && parent->GetRight()->GetRight()->IsRed()))
-				{
-					//case 1.1L
-					FirstLRotate(parent->GetRight());
-				}
-				else
-				{
-					//case 1.2L
-					parent->GetRight()->Recolor();
-					parent->Recolor();
-				}
-			}
-			else
+			Node* parent = root->GetParent();
+			//double cases because of symmetries
+			if (root == parent->GetLeft())
 			{
-				if (parent->GetRight()->IsRed())
+				if (parent->IsRed())
 				{
-					//middle two cases
-					if ((parent->GetRight()->GetLeft()->GetRight() != NULL && parent->GetRight()->GetLeft()->GetRight()->IsRed())
-						|| (parent->GetRight()->GetLeft()->GetLeft() != NULL && parent->GetRight()->GetLeft()->GetLeft()->IsRed()))
+					//first two cases
+					if ((parent->GetRight()->GetLeft() != NULL && parent->GetRight()->GetLeft()->IsRed())
+						|| (parent->GetRight()->GetRight() != NULL && parent->GetRight()->GetRight()->IsRed()))
 					{
-						//case 2.1.1L
-						SecondLRotate(parent->GetRight());
+						//case 1.1L
+						FirstLRotate(parent->GetRight());
 					}
 					else
 					{
-						//case 2.1.2L
-						ThirdLRotate(parent->GetRight());
+						//case 1.2L
+						parent->GetRight()->Recolor();
+						parent->Recolor();
+						RED_BLACK_TREE_COUNT(this->stats.reducedHeightRecolors += 2;)
 					}
 				}
 				else
 				{
-					//last two cases
-					if ((parent->GetRight()->GetLeft() != NULL && parent->GetRight()->GetLeft()->IsRed())
-						|| (parent->GetRight()->GetRight() != NULL && parent->GetRight()->GetRight()->IsRed()))
+					if (parent->GetRight()->IsRed())
 					{
-						//case 2.2.1L
-						ForthLRotate(parent->GetRight());
+						//middle two cases
+						if ((parent->GetRight()->GetLeft()->GetRight() != NULL && parent->GetRight()->GetLeft()->GetRight()->IsRed())
+							|| (parent->GetRight()->GetLeft()->GetLeft() != NULL && parent->GetRight()->GetLeft()->GetLeft()->IsRed()))
+						{
+							//case 2.1.1L
+							SecondLRotate(parent->GetRight());
+						}
+						else
+						{
+							//case 2.1.2L
+							ThirdLRotate(parent->GetRight());
+						}
 					}
 					else
 					{
-						//case 2.2.2L
-						parent->GetRight()->Recolor();
-						if (parent->GetParent() != NULL) RestoreReducedHeight(parent);
-						//otherwise overall black height reduced by 1
+						//last two cases
+						if ((parent->GetRight()->GetLeft() != NULL && parent->GetRight()->GetLeft()->IsRed())
+							|| (parent->GetRight()->GetRight() != NULL && parent->GetRight()->GetRight()->IsRed()))
+						{
+							//case 2.2.1L
+							ForthLRotate(parent->GetRight());
+						}
+						else
+						{
+							//case 2.2.2L
+							parent->GetRight()->Recolor();
+							RED_BLACK_TREE_COUNT(this->stats.reducedHeightRecolors++;)
+							//check one level up - at the real root overall black height is reduced by 1
+							root = parent;
+							continue;
+						}
 					}
 				}
 			}
-		}
-		else
-		{
-			if (parent->IsRed())
-			{
-				//first two cases
-				if ((parent->GetLeft()->GetLeft() != NULL && parent->GetLeft()->GetLeft()->IsRed())
-					|| (parent->GetLeft()->GetRight() != NULL && parent->GetLeft()->GetRight()->IsRed()))
-				{
-					//case 1.1R
-					FirstRRotate(parent->GetLeft());
-				}
-				else
-				{
-					//case 1.2R
-					parent->GetLeft()->Recolor();
-					parent->Recolor();
-				}
-			}
 			else
 			{
-				if (parent->GetLeft()->IsRed())
+				if (parent->IsRed())
 				{
-					//middle two cases
-					if ((parent->GetLeft()->GetRight()->GetRight() != NULL && parent->GetLeft()->GetRight()->GetRight()->IsRed())
-						|| (parent->GetLeft()->GetRight()->GetLeft() != NULL && parent->GetLeft()->GetRight()->GetLeft()->IsRed()))
+					//first two cases
+					if ((parent->GetLeft()->GetLeft() != NULL && parent->GetLeft()->GetLeft()->IsRed())
+						|| (parent->GetLeft()->GetRight() != NULL && parent->GetLeft()->GetRight()->IsRed()))
 					{
-						//case 2.1.1R
-						SecondRRotate(parent->GetLeft());
+						//case 1.1R
+						FirstRRotate(parent->GetLeft());
 					}
 					else
 					{
-						//case 2.1.2R
-						ThirdRRotate(parent->GetLeft());
+						//case 1.2R
+						parent->GetLeft()->Recolor();
+						parent->Recolor();
+						RED_BLACK_TREE_COUNT(this->stats.reducedHeightRecolors += 2;)
 					}
 				}
 				else
 				{
-					//last two cases
-					if ((parent->GetLeft()->GetLeft() != NULL && parent->GetLeft()->GetLeft()->IsRed())
-						|| (parent->GetLeft()->GetRight() != NULL && parent->GetLeft()->GetRight()->IsRed()))
+					if (parent->GetLeft()->IsRed())
 					{
-						//case 2.2.1R
-						ForthRRotate(parent->GetLeft());
+						//middle two cases
+						if ((parent->GetLeft()->GetRight()->GetRight() != NULL && parent->GetLeft()->GetRight()->GetRight()->IsRed())
+							|| (parent->GetLeft()->GetRight()->GetLeft() != NULL && parent->GetLeft()->GetRight()->GetLeft()->IsRed()))
+						{
+							//case 2.1.1R
+							SecondRRotate(parent->GetLeft());
+						}
+						else
+						{
+							//case 2.1.2R
+							ThirdRRotate(parent->GetLeft());
+						}
 					}
 					else
 					{
-						//case 2.2.2R
-						parent->GetLeft()->Recolor();
-						if (parent->GetParent() != NULL) RestoreReducedHeight(parent);
-						//otherwise overall black height reduced by 1
+						//last two cases
+						if ((parent->GetLeft()->GetLeft() != NULL && parent->GetLeft()->GetLeft()->IsRed())
+							|| (parent->GetLeft()->GetRight() != NULL && parent->GetLeft()->GetRight()->IsRed()))
+						{
+							//case 2.2.1R
+							ForthRRotate(parent->GetLeft());
+						}
+						else
+						{
+							//case 2.2.2R
+							parent->GetLeft()->Recolor();
+							RED_BLACK_TREE_COUNT(this->stats.reducedHeightRecolors++;)
+							//check one level up - at the real root overall black height is reduced by 1
+							root = parent;
+							continue;
+						}
 					}
 				}
 			}
+			return;
 		}
 	}
-	void FirstLRotate(RBNode<T> *root)
+	void FirstLRotate(Node *root)
 	{
-		RBNode<T> *parent = root->GetParent();
+		RED_BLACK_TREE_COUNT(this->stats.rotations[RedBlackTreeStats::FirstLRotation]++;)
+		Node *parent = root->GetParent();
 		//avl similar case 2 for left rotation - double rotation
 		if (root->GetLeft() != NULL && root->GetLeft()->IsRed())
 		{
-			RBNode<T> *badChild = root->GetLeft();
+			Node *badChild = root->GetLeft();
 			root->SetLeft(badChild->GetRight());
 			badChild->SetRight(root);
 			parent->SetRight(badChild);
@@ -483,15 +2244,19 @@ private:
 			root = this->root;
 		}
 		root->SetLeft(parent);
+		this->UpdateRotated(root);
 	}
-	void SecondLRotate(RBNode<T> *root)
+	void SecondLRotate(Node *root)
 	{
-		RBNode<T>* parent = root->GetParent();
-		RBNode<T>* grandParent = parent->GetParent();
+		RED_BLACK_TREE_COUNT(this->stats.rotations[RedBlackTreeStats::SecondLRotation]++;)
+		Node* parent = root->GetParent();
+		Node* grandParent = parent->GetParent();
+		bool redChildMoved = false;
 		//make red child always on the right
 		if (root->GetLeft()->GetLeft() != NULL && root->GetLeft()->GetLeft()->IsRed())
 		{
-			RBNode<T> *badChild = root->GetLeft()->GetLeft();
+			redChildMoved = true;
+			Node *badChild = root->GetLeft()->GetLeft();
 			root->GetLeft()->SetLeft(badChild->GetRight());
 			badChild->SetRight(root->GetLeft());
 			root->SetLeft(badChild);
@@ -515,10 +2280,14 @@ private:
 			this->root = parent->GetParent();
 			this->root->ClearParent();
 		}
+		//the red child moved on the right has a new subtree too
+		if (redChildMoved) this->UpdateAugment(parent->GetParent()->GetRight()->GetLeft());
+		this->UpdateRotated(parent->GetParent());
 	}
-	void ThirdLRotate(RBNode<T> *root)
+	void ThirdLRotate(Node *root)
 	{
-		RBNode<T>* parent = root->GetParent();
+		RED_BLACK_TREE_COUNT(this->stats.rotations[RedBlackTreeStats::ThirdLRotation]++;)
+		Node* parent = root->GetParent();
 		root->GetLeft()->Recolor();
 		parent->SetRight(root->GetLeft());
 		root->Recolor();
@@ -535,14 +2304,16 @@ private:
 			this->root->ClearParent();
 		}
 		root->SetLeft(parent);
+		this->UpdateRotated(root);
 	}
-	void ForthLRotate(RBNode<T> *root)
+	void ForthLRotate(Node *root)
 	{
-		RBNode<T> *parent = root->GetParent();
+		RED_BLACK_TREE_COUNT(this->stats.rotations[RedBlackTreeStats::ForthLRotation]++;)
+		Node *parent = root->GetParent();
 		//avl similar case 2 for left rotation - double rotation
 		if (root->GetLeft() != NULL && root->GetLeft()->IsRed())
 		{
-			RBNode<T> *badChild = root->GetLeft();
+			Node *badChild = root->GetLeft();
 			root->SetLeft(badChild->GetRight());
 			badChild->SetRight(root);
 			parent->SetRight(badChild);
@@ -568,14 +2339,16 @@ private:
 			root = this->root;
 		}
 		root->SetLeft(parent);
+		this->UpdateRotated(root);
 	}
-	void FirstRRotate(RBNode<T> *root)
+	void FirstRRotate(Node *root)
 	{
-		RBNode<T> *parent = root->GetParent();
+		RED_BLACK_TREE_COUNT(this->stats.rotations[RedBlackTreeStats::FirstRRotation]++;)
+		Node *parent = root->GetParent();
 		//avl similar case 2 for left rotation - double rotation
 		if (root->GetRight() != NULL && root->GetRight()->IsRed())
 		{
-			RBNode<T> *badChild = root->GetRight();
+			Node *badChild = root->GetRight();
 			root->SetRight(badChild->GetLeft());
 			badChild->SetLeft(root);
 			parent->SetLeft(badChild);
@@ -603,15 +2376,19 @@ private:
 			root = this->root;
 		}
 		root->SetRight(parent);
+		this->UpdateRotated(root);
 	}
-	void SecondRRotate(RBNode<T> *root)
+	void SecondRRotate(Node *root)
 	{
-		RBNode<T>* parent = root->GetParent();
-		RBNode<T>* grandParent = parent->GetParent();
+		RED_BLACK_TREE_COUNT(this->stats.rotations[RedBlackTreeStats::SecondRRotation]++;)
+		Node* parent = root->GetParent();
+		Node* grandParent = parent->GetParent();
+		bool redChildMoved = false;
 		//make red child always on the right
 		if (root->GetRight()->GetRight() != NULL && root->GetRight()->GetRight()->IsRed())
 		{
-			RBNode<T> *badChild = root->GetRight()->GetRight();
+			redChildMoved = true;
+			Node *badChild = root->GetRight()->GetRight();
 			root->GetRight()->SetRight(badChild->GetLeft());
 			badChild->SetLeft(root->GetRight());
 			root->SetRight(badChild);
@@ -635,10 +2412,14 @@ private:
 			this->root = parent->GetParent();
 			this->root->ClearParent();
 		}
+		//the red child moved on the left has a new subtree too
+		if (redChildMoved) this->UpdateAugment(parent->GetParent()->GetLeft()->GetRight());
+		this->UpdateRotated(parent->GetParent());
 	}
-	void ThirdRRotate(RBNode<T> *root)
+	void ThirdRRotate(Node *root)
 	{
-		RBNode<T>* parent = root->GetParent();
+		RED_BLACK_TREE_COUNT(this->stats.rotations[RedBlackTreeStats::ThirdRRotation]++;)
+		Node* parent = root->GetParent();
 		root->GetRight()->Recolor();
 		parent->SetLeft(root->GetRight());
 		root->Recolor();
@@ -655,14 +2436,16 @@ private:
 			this->root->ClearParent();
 		}
 		root->SetRight(parent);
+		this->UpdateRotated(root);
 	}
-	void ForthRRotate(RBNode<T> *root)
+	void ForthRRotate(Node *root)
 	{
-		RBNode<T> *parent = root->GetParent();
+		RED_BLACK_TREE_COUNT(this->stats.rotations[RedBlackTreeStats::ForthRRotation]++;)
+		Node *parent = root->GetParent();
 		//avl similar case 2 for left rotation - double rotation
 		if (root->GetRight() != NULL && root->GetRight()->IsRed())
 		{
-			RBNode<T> *badChild = root->GetRight();
+			Node *badChild = root->GetRight();
 			root->SetRight(badChild->GetLeft());
 			badChild->SetLeft(root);
 			parent->SetLeft(badChild);
@@ -688,156 +2471,671 @@ private:
 			root = this->root;
 		}
 		root->SetRight(parent);
+		this->UpdateRotated(root);
 	}
 public:
-	RedBlackTree()
+	//bidirectional in-order iterator, end() is the NULL node of its tree
+	//values are read only as their order must not change
+	class Iterator
+	{
+	private:
+		friend class RedBlackTree;
+		Node* node;
+		const RedBlackTree* tree;
+
+		Iterator(Node* node, const RedBlackTree* tree) : node(node), tree(tree)
+		{
+		}
+	public:
+		typedef bidirectional_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const T* pointer;
+		typedef const T& reference;
+
+		Iterator() : node(NULL), tree(NULL)
+		{
+		}
+		Node* GetNode() const
+		{
+			return this->node;
+		}
+		reference operator*() const
+		{
+			return this->node->GetValue();
+		}
+		pointer operator->() const
+		{
+			return &this->node->GetValue();
+		}
+		Iterator& operator++()
+		{
+			this->node = RedBlackTree::Successor(this->node);
+			return *this;
+		}
+		Iterator operator++(int)
+		{
+			Iterator previous = *this;
+			++*this;
+			return previous;
+		}
+		Iterator& operator--()
+		{
+			if (this->node == NULL) this->node = RedBlackTree::Maximum(this->tree->root);
+			else this->node = RedBlackTree::Predecessor(this->node);
+			return *this;
+		}
+		Iterator operator--(int)
+		{
+			Iterator previous = *this;
+			--*this;
+			return previous;
+		}
+		bool operator==(const Iterator& other) const
+		{
+			return this->node == other.node;
+		}
+		bool operator!=(const Iterator& other) const
+		{
+			return this->node != other.node;
+		}
+	};
+	typedef Iterator iterator;
+	typedef Iterator const_iterator;
+	typedef T value_type;
+
+	explicit RedBlackTree(const Compare& compare = Compare(), const Alloc& alloc = Alloc()) : compare(compare), nodeAllocator(alloc)
+	{
+		this->root = NULL;
+		this->bulkFreeList = NULL;
+		this->relaxedBalance = false;
+	}
+	//linear time build from values sorted by Compare, see BuildFromSorted
+	template <class ForwardIterator> RedBlackTree(ForwardIterator first, ForwardIterator last,
+		const Compare& compare = Compare(), const Alloc& alloc = Alloc()) : compare(compare), nodeAllocator(alloc)
 	{
 		this->root = NULL;
+		this->bulkFreeList = NULL;
+		this->relaxedBalance = false;
+		this->BuildFromSorted(first, last);
+	}
+	~RedBlackTree()
+	{
+		this->ReleaseAll();
+	}
+	//frees the whole tree - O(chunks) with a pool allocator and trivially destructible values
+	void ReleaseAll()
+	{
+		this->ReleaseAll(integral_constant<bool, IsReleasableAllocator<NodeAllocator>::value
+			&& is_trivially_destructible<T>::value>());
 	}
 	bool IsEmpty()
 	{
 		return root == NULL;
 	}
+	//counters since construction or the last ResetStats, all zero unless built with RED_BLACK_TREE_STATS
+	RedBlackTreeStats Stats() const
+	{
+#if defined(RED_BLACK_TREE_STATS)
+		RedBlackTreeStats snapshot = this->stats;
+		this->sharedStats.CopyTo(snapshot);
+		return snapshot;
+#else
+		return RedBlackTreeStats();
+#endif
+	}
+	void ResetStats()
+	{
+		RED_BLACK_TREE_COUNT(this->stats.Reset(); this->sharedStats.Reset();)
+	}
+	//replaces the contents with values sorted by Compare in O(n): repeated values are kept once
+	//all nodes come from one contiguous block and no rebalancing is needed
+	template <class ForwardIterator> void BuildFromSorted(ForwardIterator first, ForwardIterator last)
+	{
+		this->ReleaseAll();
+		this->SetRoot(this->BuildSorted(first, last, NULL));
+	}
+	//adds values sorted by Compare after the current ones in O(k + log n), values not greater than the maximum are skipped
+	//so a sorted stream can be built piece by piece without knowing its length
+	template <class ForwardIterator> void AppendSorted(ForwardIterator first, ForwardIterator last)
+	{
+		Subtree appended = this->BuildSorted(first, last, Maximum(this->root));
+		this->SetRoot(this->ConcatenateNodes(Subtree(this->root, this->BlackHeight()), appended));
+	}
+	//contiguous read only copy with faster lookups, for trees that stop changing - needs FrozenRedBlackTree.h
+	FrozenRedBlackTree<T, Compare> Freeze()
+	{
+		return FrozenRedBlackTree<T, Compare>(this->begin(), this->end(), this->compare);
+	}
+	//the same as a k-ary tree searched with SIMD, for arithmetic values in their natural order - needs StaticBTree.h
+	StaticBTree<T> ExportBTree()
+	{
+		static_assert(is_same<Compare, less<T> >::value || is_same<Compare, less<void> >::value, "ExportBTree needs the natural order");
+		return StaticBTree<T>(this->begin(), this->end());
+	}
 
 	//the three basic functionalities (clients interface)
-	RBNode<T>* AccessNode(T value)
+	Node* AccessNode(const T& value)
+	{
+		RED_BLACK_TREE_COUNT(RedBlackTreeStats::SharedTimer timer(this->sharedStats.lookupLatency);)
+		return this->AccessNode(this->root, value);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, Node*>::type AccessNode(const K& key)
+	{
+		RED_BLACK_TREE_COUNT(RedBlackTreeStats::SharedTimer timer(this->sharedStats.lookupLatency);)
+		return this->AccessNode(this->root, key);
+	}
+	//AccessNode for n keys at once, out[i] gets the node of keys[i] - much faster than a loop once the tree is out of cache
+	void AccessBatch(const T* keys, size_t n, Node** out)
+	{
+		this->AccessBatch(this->root, keys, n, out);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value>::type AccessBatch(const K* keys, size_t n, Node** out)
+	{
+		this->AccessBatch(this->root, keys, n, out);
+	}
+	//in-order iteration and range scans: O(log n + k) for k visited values
+	Iterator begin()
+	{
+		return Iterator(Minimum(this->root), this);
+	}
+	Iterator end()
+	{
+		return Iterator(NULL, this);
+	}
+	Iterator lower_bound(const T& value)
+	{
+		return Iterator(this->LowerBound(this->root, value), this);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, Iterator>::type lower_bound(const K& key)
+	{
+		return Iterator(this->LowerBound(this->root, key), this);
+	}
+	Iterator upper_bound(const T& value)
+	{
+		return Iterator(this->UpperBound(this->root, value), this);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, Iterator>::type upper_bound(const K& key)
+	{
+		return Iterator(this->UpperBound(this->root, key), this);
+	}
+	pair<Iterator, Iterator> equal_range(const T& value)
+	{
+		return make_pair(this->lower_bound(value), this->upper_bound(value));
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, pair<Iterator, Iterator> >::type equal_range(const K& key)
+	{
+		return make_pair(this->lower_bound(key), this->upper_bound(key));
+	}
+	void InsertNode(const T& value)
+	{
+		this->InsertUnique(value);
+	}
+	//insertion returning the node holding the value and whether it was inserted
+	pair<Node*, bool> Insert(const T& value)
+	{
+		return this->InsertUnique(value);
+	}
+	pair<Node*, bool> Insert(T&& value)
 	{
-		if (this->IsEmpty()) return NULL;
-		else return this->AccessNode(root, value);
+		return this->InsertUnique(move(value));
 	}
-	void InsertNode(T value)
+	//constructs the value directly inside a new node - the node is freed again if the value is present
+	template <class... Args> pair<Node*, bool> Emplace(Args&&... args)
 	{
-		if (this->IsEmpty())
+		RED_BLACK_TREE_COUNT(RedBlackTreeStats::Timer timer(this->stats.insertLatency);)
+		Node* insertedNode = this->CreateNode(forward<Args>(args)...);
+		Node* equal;
+		bool left;
+		Node* parent = this->FindSlot(this->root, insertedNode->GetValue(), equal, left);
+		if (equal != NULL)
 		{
-			this->root = new RBNode<T>(value);
-			this->root->Recolor();
+			this->DestroyNode(insertedNode);
+			return make_pair(equal, false);
 		}
-		else this->InsertNode(this->root, value);
+		this->AttachNode(parent, left, insertedNode);
+		return make_pair(insertedNode, true);
 	}
-	void DeleteNode(T value)
+	//looks the key up first and constructs the value from args only if it is missing
+	//the comparator must accept the key against values, as a transparent one does
+	template <class K, class... Args> pair<Node*, bool> TryEmplace(const K& key, Args&&... args)
 	{
-		if (this->IsEmpty()) return;
-		else this->DeleteNode(root, value);
+		RED_BLACK_TREE_COUNT(RedBlackTreeStats::Timer timer(this->stats.insertLatency);)
+		Node* equal;
+		bool left;
+		Node* parent = this->FindSlot(this->root, key, equal, left);
+		if (equal != NULL) return make_pair(equal, false);
+		Node* insertedNode = this->CreateNode(forward<Args>(args)...);
+		this->AttachNode(parent, left, insertedNode);
+		return make_pair(insertedNode, true);
+	}
+	void DeleteNode(const T& value)
+	{
+		RED_BLACK_TREE_COUNT(RedBlackTreeStats::Timer timer(this->stats.deleteLatency);)
+		Node* node = this->AccessNode(this->root, value);
+		if (node != NULL) this->RemoveNode(node);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value>::type DeleteNode(const K& key)
+	{
+		RED_BLACK_TREE_COUNT(RedBlackTreeStats::Timer timer(this->stats.deleteLatency);)
+		Node* node = this->AccessNode(this->root, key);
+		if (node != NULL) this->RemoveNode(node);
+	}
+	//single pass variants of InsertNode and DeleteNode: every split, rotation and color flip is made on the way down
+	//the trees they leave are valid red-black trees, shaped a little differently - both kinds of operations mix freely
+	//augmented trees still update the augments along the path afterwards
+	pair<Node*, bool> InsertTopDown(const T& value)
+	{
+		return this->InsertUniqueTopDown(value);
+	}
+	pair<Node*, bool> InsertTopDown(T&& value)
+	{
+		return this->InsertUniqueTopDown(move(value));
+	}
+	void InsertNodeTopDown(const T& value)
+	{
+		this->InsertUniqueTopDown(value);
+	}
+	//returns whether the value was there
+	bool DeleteNodeTopDown(const T& value)
+	{
+		return this->RemoveTopDown(value);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, bool>::type DeleteNodeTopDown(const K& key)
+	{
+		return this->RemoveTopDown(key);
 	}
 
-	//traversals
-	void LevelTraversal()
+	//relaxed balance for write bursts, as in chromatic trees: InsertNode, DeleteNode and the rest of the one by one updates
+	//only record the red-red pairs and the missing blackness they leave, Rebalance repairs them later
+	//lookups, iteration and order statistics stay exact all along, only the paths grow longer until the repairs
+	//operations that need the black heights - joins, splits, set operations, AppendSorted, the top-down variants - repair everything first
+	//a deleted value whose node still waits in the queue is destroyed when Rebalance gets to it; switching off repairs everything
+	void SetRelaxedBalance(bool relaxed)
 	{
-		if (this->IsEmpty()) return;
-		queue<RBNode<T>*> traversalQ;
-		HANDLE hConsole;
-		hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-		SetConsoleTextAttribute(hConsole, 15);
-		cout << this->root->GetValue() << endl;
-		traversalQ.push(this->root);
-		traversalQ.push(NULL);
-		while (true)
+		this->relaxedBalance = relaxed;
+		if (!relaxed) this->Rebalance((size_t)-1);
+	}
+	bool IsRelaxedBalance()
+	{
+		return this->relaxedBalance;
+	}
+	//repairs up to budget violations, each with O(1) rotations and recolorings, and returns how many may be left
+	//meant to be called between bursts, or by a background thread through ConcurrentRedBlackTree::Rebalance
+	size_t Rebalance(size_t budget)
+	{
+		//the latest first, they lie where the last updates went and are likely still cached
+		for (; budget > 0 && !this->rebalanceQueue.empty(); budget--)
 		{
-			if (traversalQ.front() == NULL)
+			Node* node = this->rebalanceQueue.back();
+			this->rebalanceQueue.pop_back();
+			size_t extra = this->ExtraBlackness(node);
+			node->SetQueued(false);
+			if (this->IsDeleted(node)) this->DestroyNode(node);
+			else if (extra == 0) this->SolveRedViolation(node);
+			else
 			{
-				cout << "\n";
-				traversalQ.push(NULL);
+				this->extraBlackness.erase(node);
+				if (extra > 1) this->AddBlackness(node, extra - 1);
+				if (node->GetParent() != NULL) this->ReduceDeficit(node->GetParent(), node->GetParent()->GetRight() == node);
 			}
-			else
+		}
+		return this->rebalanceQueue.size();
+	}
+
+	//batch insertion of any range of values, returns how many were inserted
+	//the batch is sorted and, when dense, each search starts from the node of the previous key: O(log d) for a distance d
+	//when the batch is big against the tree, both are merged and relinked in O(n + k) instead
+	//either way nodes are only relinked, never moved or freed, so pointers and iterators stay valid as with InsertNode
+	template <class InputIterator> size_t InsertBatch(InputIterator first, InputIterator last)
+	{
+		vector<T> batch(first, last);
+		this->SortBatch(batch);
+		if (batch.empty()) return 0;
+		size_t inserted = 0;
+		if (this->PrefersMerge(batch.size() / 4))
+		{
+			//relinking needs no pending violations
+			this->Rebalance((size_t)-1);
+			vector<Node*> nodes;
+			this->CollectSorted(nodes);
+			vector<Node*> merged;
+			merged.reserve(nodes.size() + batch.size());
+			//the new nodes come from one contiguous block, as in BuildFromSorted
+			Node* fresh = NodeAllocatorTraits::allocate(this->nodeAllocator, batch.size());
+			this->AddBlock(fresh, batch.size());
+			size_t i = 0, j = 0;
+			while (i < nodes.size() || j < batch.size())
 			{
-				if (traversalQ.front()->GetLeft() != NULL)
+				if (j == batch.size() || (i < nodes.size() && this->compare(nodes[i]->GetValue(), batch[j]))) merged.push_back(nodes[i++]);
+				else if (i == nodes.size() || this->compare(batch[j], nodes[i]->GetValue()))
 				{
-					//display in proper color
-					if (traversalQ.front()->GetLeft()->IsRed())
-					{
-						HANDLE hConsole;
-						hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-						SetConsoleTextAttribute(hConsole, 12);
-						cout << traversalQ.front()->GetLeft()->GetValue();
-						SetConsoleTextAttribute(hConsole, 15);
-					}
-					else cout << traversalQ.front()->GetLeft()->GetValue();
-					traversalQ.push(traversalQ.front()->GetLeft());
+					NodeAllocatorTraits::construct(this->nodeAllocator, fresh + inserted, move(batch[j++]));
+					merged.push_back(fresh + inserted++);
 				}
-				else cout << "n";
-				cout << " ";
-				if (traversalQ.front()->GetRight() != NULL)
+				//already present
+				else j++;
+			}
+			for (size_t k = batch.size(); k > inserted; k--) this->PushBulkFree(fresh + k - 1);
+			this->RelinkSorted(merged);
+			return inserted;
+		}
+		//sparse batches descend from the root, whose upper levels stay cached between the sorted keys
+		bool dense = this->IsDenseBatch(batch[batch.size() / 2], batch.size());
+		Node* finger = NULL;
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			Node* bound;
+			Node* equal;
+			bool left;
+			Node* parent = this->FindSlot(this->FingerStart(finger, batch[i], bound), batch[i], equal, left);
+			Node* node = equal;
+			if (node == NULL)
+			{
+				node = this->CreateNode(move(batch[i]));
+				this->AttachNode(parent, left, node);
+				inserted++;
+			}
+			if (dense) finger = node;
+		}
+		return inserted;
+	}
+	//batch deletion, returns how many values were removed - only the nodes of removed values become invalid
+	template <class InputIterator> size_t DeleteBatch(InputIterator first, InputIterator last)
+	{
+		vector<T> batch(first, last);
+		this->SortBatch(batch);
+		if (batch.empty()) return 0;
+		size_t removed = 0;
+		if (this->PrefersMerge(2 * batch.size()))
+		{
+			this->Rebalance((size_t)-1);
+			vector<Node*> nodes;
+			this->CollectSorted(nodes);
+			size_t kept = 0, j = 0;
+			for (size_t i = 0; i < nodes.size(); i++)
+			{
+				while (j < batch.size() && this->compare(batch[j], nodes[i]->GetValue())) j++;
+				if (j < batch.size() && !this->compare(nodes[i]->GetValue(), batch[j]))
 				{
-					//display in proper color
-					if (traversalQ.front()->GetRight()->IsRed())
-					{
-						HANDLE hConsole;
-						hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-						SetConsoleTextAttribute(hConsole, 12);
-						cout << traversalQ.front()->GetRight()->GetValue();
-						SetConsoleTextAttribute(hConsole, 15);
-					}
-					else cout << traversalQ.front()->GetRight()->GetValue();
-					traversalQ.push(traversalQ.front()->GetRight());
+					this->DestroyNode(nodes[i]);
+					removed++;
 				}
-				else cout << "n";
-				cout << "  ";
+				else nodes[kept++] = nodes[i];
 			}
-
-			traversalQ.pop();
-			if (traversalQ.back() == NULL && traversalQ.front() == NULL) break;
+			nodes.resize(kept);
+			this->RelinkSorted(nodes);
+			return removed;
 		}
-		cout << "\n\n";
+		//the finger is the last node known to be less than the next key
+		bool dense = this->IsDenseBatch(batch[batch.size() / 2], batch.size());
+		Node* finger = NULL;
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			Node* bound;
+			Node* node = this->LowerBound(this->FingerStart(finger, batch[i], bound), batch[i]);
+			if (node == NULL) node = bound;
+			if (node == NULL || this->compare(batch[i], node->GetValue())) continue;
+			//nodes are relinked and never moved by a removal, so the predecessor stays valid
+			if (dense) finger = Predecessor(node);
+			this->RemoveNode(node);
+			removed++;
+		}
+		return removed;
 	}
-	bool BlackHeightTraversal()
+	//the same for n values in a plain array
+	size_t InsertBatch(const T* values, size_t n)
+	{
+		return this->InsertBatch(values, values + n);
+	}
+	size_t DeleteBatch(const T* values, size_t n)
+	{
+		return this->DeleteBatch(values, values + n);
+	}
+
+	//black height of the tree, the one BlackHeightTraversal checks to be the same on every path
+	//with relaxed balance everything pending is repaired first, joins, splits and set operations rely on it
+	size_t BlackHeight()
 	{
-		if (this->IsEmpty()) return true;
-		stack<RBNode<T>*> traversalS;
-		int trueBlackHeight = 0;
-		int blackHeight = 0;
-		if (root != NULL){
-			blackHeight++;
-			traversalS.push(this->root);
+		this->Rebalance((size_t)-1);
+		return BlackHeightOf(this->root);
+	}
+	//join and split - nodes change trees as they are, so they run in O(log n) without any copies
+	//with allocators that compare unequal, like PoolAllocator trees constructed without a shared allocator, the moved values get new nodes in O(n) instead
+	//replaces the contents with the values of left, the pivot and the values of right, all of them taken from these trees
+	//every value of left must be less than the pivot and every value of right greater, either may be this tree itself
+	void Join(RedBlackTree& left, const T& pivot, RedBlackTree& right)
+	{
+		if (&left != this && &right != this) this->ReleaseAll();
+		Subtree leftTree = this->TakeTree(left);
+		Subtree rightTree = this->TakeTree(right);
+		this->SetRoot(this->JoinNodes(leftTree, this->CreateNode(pivot), rightTree));
+	}
+	//the same without a pivot: every value of left must be less than every value of right
+	void Join(RedBlackTree& left, RedBlackTree& right)
+	{
+		if (&left != this && &right != this) this->ReleaseAll();
+		Subtree leftTree = this->TakeTree(left);
+		Subtree rightTree = this->TakeTree(right);
+		this->SetRoot(this->ConcatenateNodes(leftTree, rightTree));
+	}
+	//keeps the values less than the key and moves the others into right, replacing its contents
+	void Split(const T& key, RedBlackTree& right)
+	{
+		this->SplitAt(key, right);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value>::type Split(const K& key, RedBlackTree& right)
+	{
+		this->SplitAt(key, right);
+	}
+	//set operations in O(m log(n/m + 1)), forking over the cores while both trees are large
+	//values of this tree win over equal ones of the other, which is left empty by the union
+	void Union(RedBlackTree& other)
+	{
+		if (&other == this) return;
+		Subtree otherTree = this->TakeTree(other);
+		this->RunSetOperation(UnionOperation, otherTree);
+	}
+	//the other tree is only read by intersection and difference
+	void Intersection(RedBlackTree& other)
+	{
+		if (&other == this) return;
+		this->RunSetOperation(IntersectionOperation, Subtree(other.root, other.BlackHeight()));
+	}
+	void Difference(RedBlackTree& other)
+	{
+		if (&other == this)
+		{
+			this->ReleaseAll();
+			return;
 		}
+		this->RunSetOperation(DifferenceOperation, Subtree(other.root, other.BlackHeight()));
+	}
 
-		while (!traversalS.empty())
+	//order statistics - only with the OrderStatistics augmentation, all in O(log n)
+	size_t Size()
+	{
+		return SubtreeSize(this->root);
+	}
+	//k-th smallest value counting from 0, NULL if there are not that many values
+	Node* Select(size_t k)
+	{
+		Node* node = this->root;
+		while (node != NULL)
 		{
-			RBNode<T>* root = traversalS.top();
-			traversalS.pop();
-			if (root->GetLeft() != NULL) traversalS.push(root->GetLeft());
+			size_t leftSize = SubtreeSize(node->GetLeft());
+			if (k < leftSize) node = node->GetLeft();
+			else if (k == leftSize) return node;
 			else
 			{
-				if (trueBlackHeight == 0) trueBlackHeight = blackHeight;
-				else if (trueBlackHeight != blackHeight) break;
+				k -= leftSize + 1;
+				node = node->GetRight();
 			}
+		}
+		return NULL;
+	}
+	//number of values less than the key
+	size_t Rank(const T& value)
+	{
+		return this->RankOf(value);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, size_t>::type Rank(const K& key)
+	{
+		return this->RankOf(key);
+	}
+	//number of values in [low, high)
+	size_t CountRange(const T& low, const T& high)
+	{
+		return this->CountRangeOf(low, high);
+	}
+	template <class K, class C = Compare> typename enable_if<IsTransparent<C>::value, size_t>::type CountRange(const K& low, const K& high)
+	{
+		return this->CountRangeOf(low, high);
+	}
 
-			if (root->GetRight() != NULL) traversalS.push(root->GetRight());
-			else
+	//monoid aggregate over [low, high) - only with a MonoidAugment, in O(log n)
+	template <class A = Augment> typename A::Monoid::ValueType Aggregate(const T& low, const T& high)
+	{
+		return this->AggregateOf<A>(low, high);
+	}
+	template <class K, class A = Augment, class C = Compare> typename enable_if<IsTransparent<C>::value, typename A::Monoid::ValueType>::type Aggregate(const K& low, const K& high)
+	{
+		return this->AggregateOf<A>(low, high);
+	}
+
+	//checks every red black tree rule, the order, the parent links and the subtree sizes in one O(n) pass
+	//an explicit stack takes the place of recursion, so even a broken tree of any depth is walked safely
+	//with relaxed balance the red-red pairs waiting for Rebalance are allowed and extra blackness counts into the black heights
+	RedBlackTreeReport Validate()
+	{
+		struct Frame
+		{
+			Node* node;
+			size_t depth;
+			int stage;
+			size_t leftBlackHeight;
+			size_t leftSize;
+		};
+		//twice the height of a perfect tree of every addressable node, and what the pending violations may add to it
+		size_t depthLimit = 2 * 8 * sizeof(size_t) + 2 + this->rebalanceQueue.size();
+		for (typename unordered_map<Node*, size_t>::iterator it = this->extraBlackness.begin(); it != this->extraBlackness.end(); ++it) depthLimit += 2 * it->second;
+		integral_constant<bool, is_base_of<OrderStatistics::Data, typename Augment::Data>::value> keepsSizes;
+		RedBlackTreeReport report = RedBlackTreeReport();
+		if (this->root == NULL) return report;
+		vector<Frame> stack;
+		Frame top = { this->root, 1, 0, 0, 0 };
+		stack.push_back(top);
+		Node* previous = NULL;
+		size_t position = 0;
+		//black height and size of the subtree finished last, a missing child has both 0
+		size_t blackHeight = 0;
+		size_t size = 0;
+		while (!stack.empty())
+		{
+			Frame& frame = stack.back();
+			Node* node = frame.node;
+			Node* next = NULL;
+			if (frame.stage == 0)
 			{
-				if (trueBlackHeight == 0) trueBlackHeight = blackHeight;
-				else if (trueBlackHeight != blackHeight) break;
+				report.nodes++;
+				if (frame.depth > report.maxDepth) report.maxDepth = frame.depth;
+				frame.stage = 1;
+				next = node->GetLeft();
 			}
-
-			if (root->GetLeft() == NULL && root->GetRight() == NULL)
+			else if (frame.stage == 1)
+			{
+				frame.leftBlackHeight = blackHeight;
+				frame.leftSize = size;
+				if (node->GetLeft() != NULL && node->GetLeft()->GetParent() != node) report.Add(report.parentViolations, "left child with a wrong parent link", position, frame.depth);
+				if (frame.depth == 1 && node->GetParent() != NULL) report.Add(report.parentViolations, "root with a parent", position, frame.depth);
+				if (frame.depth == 1 && node->IsRed()) report.Add(report.redRoot, "red root", position, frame.depth);
+				if (previous != NULL && !this->compare(previous->GetValue(), node->GetValue())) report.Add(report.orderViolations, "value not greater than its predecessor", position, frame.depth);
+				previous = node;
+				position++;
+				frame.stage = 2;
+				next = node->GetRight();
+			}
+			else
 			{
-				//calculate black height of next start
-				if (traversalS.size() > 0)
+				size_t here = position - 1;
+				if (node->GetRight() != NULL && node->GetRight()->GetParent() != node) report.Add(report.parentViolations, "right child with a wrong parent link", here, frame.depth);
+				if (node->IsRed() && (UnrecordedRed(node->GetLeft()) || UnrecordedRed(node->GetRight())))
 				{
-					if (traversalS.top()->IsRed()) blackHeight = 0;
-					else blackHeight = 1;
-					RBNode<T>* parent = traversalS.top()->GetParent();
-					while (parent != NULL)
-					{
-						if (!parent->IsRed()) blackHeight++;
-						parent = parent->GetParent();
-					}
+					report.Add(report.redRedViolations, "red node with a red child", here, frame.depth);
 				}
+				size_t extra = this->ExtraBlackness(node);
+				if (extra > 0 && node->IsRed()) report.Add(report.blackHeightViolations, "red node with extra blackness", here, frame.depth);
+				if (frame.leftBlackHeight != blackHeight) report.Add(report.blackHeightViolations, "subtrees of different black heights", here, frame.depth);
+				size = frame.leftSize + size + 1;
+				if (!SizeMatches(node, size, keepsSizes)) report.Add(report.sizeViolations, "wrong subtree size", here, frame.depth);
+				blackHeight = frame.leftBlackHeight + (node->IsRed() ? 0 : 1) + extra;
+				stack.pop_back();
+				continue;
 			}
-			else
+			blackHeight = 0;
+			size = 0;
+			if (next == NULL || next->GetParent() != node) continue;
+			if (frame.depth + 1 > depthLimit)
 			{
-				if (!traversalS.top()->IsRed()) blackHeight++;
+				report.Add(report.depthViolations, "path deeper than any red black tree", position, frame.depth + 1);
+				continue;
 			}
+			Frame child = { next, frame.depth + 1, 0, 0, 0 };
+			stack.push_back(child);
 		}
-		if (blackHeight == trueBlackHeight)
-		{
-			cout << "Tree is a red-black tree with black height " << trueBlackHeight << ".\n\n";
-			return true;
-		}
-		else
+		report.blackHeight = blackHeight;
+		return report;
+	}
+
+	//traversals
+	//prints the tree level by level, a missing child shows as n
+	template <class Output = AnsiColorOutput> void LevelTraversal(const Output& output = Output(), ostream& out = cout)
+	{
+		if (this->IsEmpty()) return;
+		queue<Node*> traversalQ;
+		output.Write(out, this->root->GetValue(), this->root->IsRed());
+		out << endl;
+		traversalQ.push(this->root);
+		traversalQ.push(NULL);
+		while (true)
 		{
-			cout << "Tree is not a red-black tree.\n\n";
-			return false;
+			if (traversalQ.front() == NULL)
+			{
+				out << "\n";
+				traversalQ.push(NULL);
+			}
+			else
+			{
+				//display in proper color
+				if (traversalQ.front()->GetLeft() != NULL)
+				{
+					output.Write(out, traversalQ.front()->GetLeft()->GetValue(), traversalQ.front()->GetLeft()->IsRed());
+					traversalQ.push(traversalQ.front()->GetLeft());
+				}
+				else out << "n";
+				out << " ";
+				if (traversalQ.front()->GetRight() != NULL)
+				{
+					output.Write(out, traversalQ.front()->GetRight()->GetValue(), traversalQ.front()->GetRight()->IsRed());
+					traversalQ.push(traversalQ.front()->GetRight());
+				}
+				else out << "n";
+				out << "  ";
+			}
+
+			traversalQ.pop();
+			if (traversalQ.back() == NULL && traversalQ.front() == NULL) break;
 		}
-		
+		out << "\n\n";
+	}
+	//prints whether the tree is a valid red black tree, see Validate
+	bool BlackHeightTraversal()
+	{
+		RedBlackTreeReport report = this->Validate();
+		if (report.IsValid()) cout << "Tree is a red-black tree with black height " << report.blackHeight << ".\n\n";
+		else cout << "Tree is not a red-black tree: " << report.firstViolation << ".\n\n";
+		return report.IsValid();
 	}
-};
\ No newline at end of file
+};
+
+#endif
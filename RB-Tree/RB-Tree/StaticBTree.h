@@ -0,0 +1,398 @@
+/*
+Static B-Tree
+read only k-ary copy of a red black tree searched with SIMD
+released under GNU GPL licence
+*/
+#ifndef STATIC_B_TREE_H
+#define STATIC_B_TREE_H
+
+#include <stdint.h>
+#include <vector>
+#include <limits>
+#include <iterator>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+#include "RedBlackTree.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define STATIC_B_TREE_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+//the SIMD code is compiled for its own instruction set only, so the rest of the program runs on any x86
+#if defined(STATIC_B_TREE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define STATIC_B_TREE_TARGET(name) __attribute__((target(name)))
+#else
+#define STATIC_B_TREE_TARGET(name)
+#endif
+
+using namespace std;
+
+enum SimdLevel
+{
+	ScalarLevel,
+	Sse42Level,
+	Avx2Level
+};
+
+struct SimdSupport
+{
+	//the best level this processor and operating system support, looked up once with CPUID
+	static SimdLevel Detected()
+	{
+		static const SimdLevel level = Detect();
+		return level;
+	}
+	static int CountBits(unsigned mask)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_popcount(mask);
+#else
+		mask = mask - ((mask >> 1) & 0x55555555);
+		mask = (mask & 0x33333333) + ((mask >> 2) & 0x33333333);
+		return (int)((((mask + (mask >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+#endif
+	}
+private:
+	static SimdLevel Detect()
+	{
+#if defined(STATIC_B_TREE_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int leaves = info[0];
+		__cpuid(info, 1);
+		bool sse42 = (info[2] & (1 << 20)) != 0;
+		//AVX registers also need the operating system to save them (OSXSAVE and XCR0)
+		bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+		bool avx2 = false;
+		if (avx && leaves >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+		if (avx2) return Avx2Level;
+		if (sse42) return Sse42Level;
+#elif defined(STATIC_B_TREE_X86)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) return Avx2Level;
+		if (__builtin_cpu_supports("sse4.2")) return Sse42Level;
+#endif
+		return ScalarLevel;
+	}
+};
+
+//which SIMD comparison fits a key type: 1 and 2 signed 32 and 64 bit integers, 3 float, 4 double, 0 none
+template <class T> struct SimdKeyKind
+{
+#if defined(STATIC_B_TREE_X86)
+	static const int value = is_floating_point<T>::value ? (sizeof(T) == 4 ? 3 : sizeof(T) == 8 ? 4 : 0)
+		: is_signed<T>::value ? (sizeof(T) == 4 ? 1 : sizeof(T) == 8 ? 2 : 0) : 0;
+#else
+	static const int value = 0;
+#endif
+};
+
+//counts the keys of one node less than x - keys of a node are sorted, so that is where x belongs in it
+template <class T, int Kind = SimdKeyKind<T>::value> struct NodeRank
+{
+	static const size_t NodeKeys = sizeof(T) >= 64 ? 1 : 64 / sizeof(T);
+	static const SimdLevel Supported = ScalarLevel;
+
+	static int Scalar(const T* keys, T x)
+	{
+		int rank = 0;
+		for (size_t i = 0; i < NodeKeys; i++) rank += keys[i] < x;
+		return rank;
+	}
+	static int Sse42(const T* keys, T x)
+	{
+		return Scalar(keys, x);
+	}
+	static int Avx2(const T* keys, T x)
+	{
+		return Scalar(keys, x);
+	}
+};
+#if defined(STATIC_B_TREE_X86)
+template <class T> struct NodeRank<T, 1> : NodeRank<T, 0>
+{
+	static const SimdLevel Supported = Avx2Level;
+
+	static STATIC_B_TREE_TARGET("sse4.2") int Sse42(const T* keys, T x)
+	{
+		__m128i key = _mm_set1_epi32((int32_t)x);
+		int mask = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			__m128i node = _mm_loadu_si128((const __m128i*)(keys + 4 * i));
+			mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(key, node))) << (4 * i);
+		}
+		return SimdSupport::CountBits((unsigned)mask);
+	}
+	static STATIC_B_TREE_TARGET("avx2") int Avx2(const T* keys, T x)
+	{
+		__m256i key = _mm256_set1_epi32((int32_t)x);
+		__m256i low = _mm256_cmpgt_epi32(key, _mm256_loadu_si256((const __m256i*)keys));
+		__m256i high = _mm256_cmpgt_epi32(key, _mm256_loadu_si256((const __m256i*)(keys + 8)));
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(low)) | (_mm256_movemask_ps(_mm256_castsi256_ps(high)) << 8);
+		return SimdSupport::CountBits((unsigned)mask);
+	}
+};
+template <class T> struct NodeRank<T, 2> : NodeRank<T, 0>
+{
+	static const SimdLevel Supported = Avx2Level;
+
+	static STATIC_B_TREE_TARGET("sse4.2") int Sse42(const T* keys, T x)
+	{
+		__m128i key = _mm_set1_epi64x((long long)x);
+		int mask = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			__m128i node = _mm_loadu_si128((const __m128i*)(keys + 2 * i));
+			mask |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(key, node))) << (2 * i);
+		}
+		return SimdSupport::CountBits((unsigned)mask);
+	}
+	static STATIC_B_TREE_TARGET("avx2") int Avx2(const T* keys, T x)
+	{
+		__m256i key = _mm256_set1_epi64x((long long)x);
+		__m256i low = _mm256_cmpgt_epi64(key, _mm256_loadu_si256((const __m256i*)keys));
+		__m256i high = _mm256_cmpgt_epi64(key, _mm256_loadu_si256((const __m256i*)(keys + 4)));
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(low)) | (_mm256_movemask_pd(_mm256_castsi256_pd(high)) << 4);
+		return SimdSupport::CountBits((unsigned)mask);
+	}
+};
+template <class T> struct NodeRank<T, 3> : NodeRank<T, 0>
+{
+	static const SimdLevel Supported = Avx2Level;
+
+	static STATIC_B_TREE_TARGET("sse4.2") int Sse42(const T* keys, T x)
+	{
+		__m128 key = _mm_set1_ps(x);
+		int mask = 0;
+		for (int i = 0; i < 4; i++) mask |= _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(keys + 4 * i), key)) << (4 * i);
+		return SimdSupport::CountBits((unsigned)mask);
+	}
+	static STATIC_B_TREE_TARGET("avx2") int Avx2(const T* keys, T x)
+	{
+		__m256 key = _mm256_set1_ps(x);
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(keys), key, _CMP_LT_OQ))
+			| (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(keys + 8), key, _CMP_LT_OQ)) << 8);
+		return SimdSupport::CountBits((unsigned)mask);
+	}
+};
+template <class T> struct NodeRank<T, 4> : NodeRank<T, 0>
+{
+	static const SimdLevel Supported = Avx2Level;
+
+	static STATIC_B_TREE_TARGET("sse4.2") int Sse42(const T* keys, T x)
+	{
+		__m128d key = _mm_set1_pd(x);
+		int mask = 0;
+		for (int i = 0; i < 4; i++) mask |= _mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(keys + 2 * i), key)) << (2 * i);
+		return SimdSupport::CountBits((unsigned)mask);
+	}
+	static STATIC_B_TREE_TARGET("avx2") int Avx2(const T* keys, T x)
+	{
+		__m256d key = _mm256_set1_pd(x);
+		int mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys), key, _CMP_LT_OQ))
+			| (_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys + 4), key, _CMP_LT_OQ)) << 4);
+		return SimdSupport::CountBits((unsigned)mask);
+	}
+};
+#endif
+
+//static search tree (S-tree) of arithmetic values in their natural order, built by RedBlackTree::ExportBTree()
+//every node is one cache line of sorted keys and has NodeKeys + 1 implicit children: node k has k * (NodeKeys + 1) + i + 1
+//a lookup reads about log(n) / log(NodeKeys + 1) lines instead of log(n) nodes, and places x in a node with
+//a few SIMD compares and a movemask instead of a chain of dependent comparisons
+//slots after the last value hold the largest value of the type, so they never come before a real value
+template <class T> class StaticBTree
+{
+private:
+	static_assert(is_arithmetic<T>::value, "StaticBTree holds arithmetic values only");
+	typedef NodeRank<T> Rank;
+	typedef int (*RankFunction)(const T*, T);
+	static const size_t CacheLine = 64;
+	static const size_t NodeKeys = Rank::NodeKeys;
+	//searches AccessBatch keeps in flight
+	static const size_t Group = 16;
+	static const size_t None = (size_t)-1;
+
+	//position 0 sits at the start of a cache line
+	vector<T> storage;
+	size_t first;
+	size_t count;
+	size_t nodeCount;
+	//whether the largest value stored equals the padding value
+	bool hasPadding;
+	SimdLevel level;
+	RankFunction rank;
+
+	static T Padding()
+	{
+		return numeric_limits<T>::has_infinity ? numeric_limits<T>::infinity() : (numeric_limits<T>::max)();
+	}
+	T* Keys()
+	{
+		return this->storage.data() + this->first;
+	}
+	const T* Keys() const
+	{
+		return this->storage.data() + this->first;
+	}
+	static void Prefetch(const void* address)
+	{
+#if defined(STATIC_B_TREE_X86)
+		_mm_prefetch((const char*)address, _MM_HINT_T0);
+#elif defined(__GNUC__) || defined(__clang__)
+		__builtin_prefetch(address);
+#endif
+	}
+	void Allocate(size_t count)
+	{
+		this->count = count;
+		this->nodeCount = (count + NodeKeys - 1) / NodeKeys;
+		this->storage.assign(this->nodeCount * NodeKeys + CacheLine / sizeof(T), T());
+		uintptr_t address = (uintptr_t)this->storage.data();
+		this->first = 0;
+		while ((address + this->first * sizeof(T)) % CacheLine != 0) this->first++;
+	}
+	//in-order walk of the implicit tree, slots left over after the values get the padding
+	template <class ForwardIterator> void Fill(size_t node, ForwardIterator& next, ForwardIterator last)
+	{
+		if (node >= this->nodeCount) return;
+		T* keys = this->Keys() + node * NodeKeys;
+		for (size_t i = 0; i < NodeKeys; i++)
+		{
+			this->Fill(node * (NodeKeys + 1) + i + 1, next, last);
+			if (next != last)
+			{
+				keys[i] = *next;
+				++next;
+			}
+			else keys[i] = Padding();
+		}
+		this->Fill(node * (NodeKeys + 1) + NodeKeys + 1, next, last);
+	}
+	//one step down: x goes before the rank-th key of the node, which is the best candidate so far
+	void Step(size_t& node, size_t& candidate, T x) const
+	{
+		size_t i = (size_t)this->rank(this->Keys() + node * NodeKeys, x);
+		if (i < NodeKeys) candidate = node * NodeKeys + i;
+		node = node * (NodeKeys + 1) + i + 1;
+	}
+	const T* Result(size_t candidate, T x) const
+	{
+		if (candidate == None) return NULL;
+		const T* key = this->Keys() + candidate;
+		if (x < *key) return NULL;
+		if (*key == Padding() && !this->hasPadding) return NULL;
+		return key;
+	}
+public:
+	//values sorted in increasing order without repetitions
+	template <class ForwardIterator> StaticBTree(ForwardIterator first, ForwardIterator last)
+	{
+		this->Allocate((size_t)distance(first, last));
+		this->hasPadding = false;
+		ForwardIterator next = first;
+		for (; next != last; ++next) this->hasPadding = *next == Padding();
+		next = first;
+		this->Fill(0, next, last);
+		this->SetSimdLevel(SimdSupport::Detected());
+	}
+	StaticBTree(const StaticBTree& other) : hasPadding(other.hasPadding), level(other.level), rank(other.rank)
+	{
+		this->Allocate(other.count);
+		copy(other.Keys(), other.Keys() + this->nodeCount * NodeKeys, this->Keys());
+	}
+	//moving keeps the buffer and with it the alignment
+	StaticBTree(StaticBTree&& other) : storage(move(other.storage)), first(other.first), count(other.count), nodeCount(other.nodeCount),
+		hasPadding(other.hasPadding), level(other.level), rank(other.rank)
+	{
+		other.first = 0;
+		other.count = 0;
+		other.nodeCount = 0;
+	}
+	StaticBTree& operator=(StaticBTree other)
+	{
+		this->storage.swap(other.storage);
+		swap(this->first, other.first);
+		swap(this->count, other.count);
+		swap(this->nodeCount, other.nodeCount);
+		swap(this->hasPadding, other.hasPadding);
+		swap(this->level, other.level);
+		swap(this->rank, other.rank);
+		return *this;
+	}
+
+	//the node search in use - lowered to what the processor and the key type support, mainly for measurements
+	SimdLevel GetSimdLevel() const
+	{
+		return this->level;
+	}
+	void SetSimdLevel(SimdLevel level)
+	{
+		SimdLevel supported = Rank::Supported;
+		this->level = min(min(level, SimdSupport::Detected()), supported);
+		if (this->level == Avx2Level) this->rank = &Rank::Avx2;
+		else if (this->level == Sse42Level) this->rank = &Rank::Sse42;
+		else this->rank = &Rank::Scalar;
+	}
+	size_t Size() const
+	{
+		return this->count;
+	}
+	bool IsEmpty() const
+	{
+		return this->count == 0;
+	}
+	//the stored value equal to x, NULL if there is none
+	const T* AccessNode(T x) const
+	{
+		size_t node = 0;
+		size_t candidate = None;
+		while (node < this->nodeCount) this->Step(node, candidate, x);
+		return this->Result(candidate, x);
+	}
+	//AccessNode for n keys at once: groups of searches go down level by level together,
+	//each prefetching its next node, so the misses of a whole group overlap
+	void AccessBatch(const T* keys, size_t n, const T** out) const
+	{
+		size_t nodes[Group];
+		size_t candidates[Group];
+		for (size_t start = 0; start < n; start += Group)
+		{
+			size_t size = n - start < Group ? n - start : Group;
+			for (size_t j = 0; j < size; j++)
+			{
+				nodes[j] = 0;
+				candidates[j] = None;
+			}
+			//the depth differs by at most one level between searches
+			bool active = this->nodeCount > 0;
+			while (active)
+			{
+				active = false;
+				for (size_t j = 0; j < size; j++)
+				{
+					if (nodes[j] >= this->nodeCount) continue;
+					this->Step(nodes[j], candidates[j], keys[start + j]);
+					if (nodes[j] < this->nodeCount)
+					{
+						Prefetch(this->Keys() + nodes[j] * NodeKeys);
+						active = true;
+					}
+				}
+			}
+			for (size_t j = 0; j < size; j++) out[start + j] = this->Result(candidates[j], keys[start + j]);
+		}
+	}
+};
+
+#endif
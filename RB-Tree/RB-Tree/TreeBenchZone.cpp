@@ -0,0 +1,709 @@
+/* TreeBenchZone.cpp :
+this short code measures the latency of the basic functionalities on large trees
+run with "full" as first argument to include the 100M keys step
+*/
+
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <string>
+#include <new>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "RedBlackTree.h"
+#include "ConcurrentRedBlackTree.h"
+#include "PersistentRedBlackTree.h"
+#include "FrozenRedBlackTree.h"
+#include "StaticBTree.h"
+#include "MappedRedBlackTree.h"
+#include "TreeStream.h"
+#include "ZoneAllocations.h"
+
+using namespace std;
+
+//64 byte key that counts how often it is copied or moved
+struct Payload64
+{
+	long long key;
+	char data[56];
+	static size_t copies, moves;
+
+	explicit Payload64(long long key) : key(key)
+	{
+		memset(this->data, 0, sizeof(this->data));
+	}
+	Payload64(const Payload64& other) : key(other.key)
+	{
+		memcpy(this->data, other.data, sizeof(this->data));
+		copies++;
+	}
+	Payload64(Payload64&& other) : key(other.key)
+	{
+		memcpy(this->data, other.data, sizeof(this->data));
+		moves++;
+	}
+	bool operator<(const Payload64& other) const
+	{
+		return this->key < other.key;
+	}
+};
+size_t Payload64::copies = 0;
+size_t Payload64::moves = 0;
+
+static double NsPerOp(chrono::steady_clock::time_point start, size_t ops)
+{
+	chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+	return elapsed.count() / ops;
+}
+
+static void MeasureInsertAndLookup(size_t n)
+{
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)i;
+	mt19937_64 generator(n);
+	shuffle(keys.begin(), keys.end(), generator);
+
+	RedBlackTree<int> *reb = new RedBlackTree<int>();
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++) reb->InsertNode(keys[i]);
+	double insertNs = NsPerOp(start, n);
+
+	//lookups in a different random order than the insertion
+	shuffle(keys.begin(), keys.end(), generator);
+	size_t found = 0;
+	start = chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++) if (reb->AccessNode(keys[i]) != NULL) found++;
+	double lookupNs = NsPerOp(start, n);
+
+	//the same lookups with interleaved descents
+	vector<RedBlackTree<int>::Node*> nodes(n);
+	start = chrono::steady_clock::now();
+	reb->AccessBatch(keys.data(), n, nodes.data());
+	double batchNs = NsPerOp(start, n);
+
+	printf("%12zu keys   insert %8.1f ns/op   lookup %8.1f ns/op   AccessBatch %8.1f ns/op   (%zu found)\n", n, insertNs, lookupNs, batchNs, found);
+	delete reb;
+}
+
+//delete and reinsert random keys on a filled tree, then release the whole tree
+template <class Tree> static void MeasureChurn(const char *name, size_t n)
+{
+	mt19937_64 generator(n);
+	Tree *reb = new Tree();
+	for (size_t i = 0; i < n; i++) reb->InsertNode((int)(generator() % (2 * n)));
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++)
+	{
+		reb->DeleteNode((int)(generator() % (2 * n)));
+		reb->InsertNode((int)(generator() % (2 * n)));
+	}
+	double churnNs = NsPerOp(start, 2 * n);
+
+	start = chrono::steady_clock::now();
+	reb->ReleaseAll();
+	chrono::duration<double, milli> releaseMs = chrono::steady_clock::now() - start;
+
+	printf("%-16s %12zu keys   churn %8.1f ns/op   release all %8.2f ms\n", name, n, churnNs, releaseMs.count());
+	delete reb;
+}
+
+//the same inserts and deletes with the fixups walking back up and with everything fixed on the way down
+template <class Tree> static void FillAndEmpty(const vector<int>& inserts, const vector<int>& deletes, bool topDown, double& insertNs, double& deleteNs, size_t& maxDepth)
+{
+	Tree *reb = new Tree();
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (topDown) for (size_t i = 0; i < inserts.size(); i++) reb->InsertNodeTopDown(inserts[i]);
+	else for (size_t i = 0; i < inserts.size(); i++) reb->InsertNode(inserts[i]);
+	insertNs = NsPerOp(start, inserts.size());
+	maxDepth = reb->Validate().maxDepth;
+	start = chrono::steady_clock::now();
+	if (topDown) for (size_t i = 0; i < deletes.size(); i++) reb->DeleteNodeTopDown(deletes[i]);
+	else for (size_t i = 0; i < deletes.size(); i++) reb->DeleteNode(deletes[i]);
+	deleteNs = NsPerOp(start, deletes.size());
+	delete reb;
+}
+template <class Tree> static void MeasureTopDown(const char *name, size_t n, bool random)
+{
+	vector<int> inserts(n);
+	for (size_t i = 0; i < n; i++) inserts[i] = (int)i;
+	vector<int> deletes(inserts);
+	if (random)
+	{
+		mt19937_64 generator(n);
+		shuffle(inserts.begin(), inserts.end(), generator);
+		shuffle(deletes.begin(), deletes.end(), generator);
+	}
+	double insertNs[2], deleteNs[2];
+	size_t maxDepth[2];
+	for (int topDown = 0; topDown < 2; topDown++) FillAndEmpty<Tree>(inserts, deletes, topDown != 0, insertNs[topDown], deleteNs[topDown], maxDepth[topDown]);
+	printf("%-16s %-10s %12zu keys   bottom-up insert %7.1f delete %7.1f ns/op   top-down insert %7.1f delete %7.1f ns/op   max depth %zu/%zu\n",
+		name, random ? "random" : "sequential", n, insertNs[0], deleteNs[0], insertNs[1], deleteNs[1], maxDepth[0], maxDepth[1]);
+}
+
+//a burst of n inserts and then n deletes on a tree of n random keys, per operation, with relaxed balance and without
+//the relaxed burst leaves its repairs to one Rebalance afterwards, timed apart; the tail shows in the slowest operations
+static void MeasureRelaxedBalance(size_t n)
+{
+	vector<int> keys(2 * n);
+	for (size_t i = 0; i < keys.size(); i++) keys[i] = (int)i;
+	mt19937_64 generator(n);
+	shuffle(keys.begin(), keys.end(), generator);
+	for (int relaxed = 0; relaxed < 2; relaxed++)
+	{
+		RedBlackTree<int> *reb = new RedBlackTree<int>();
+		for (size_t i = 0; i < n; i++) reb->InsertNode(keys[i]);
+		reb->SetRelaxedBalance(relaxed != 0);
+		RedBlackTreeStats::LatencyHistogram latency[2] = { RedBlackTreeStats::LatencyHistogram(), RedBlackTreeStats::LatencyHistogram() };
+		uint64_t slowest[2] = { 0, 0 };
+		for (int deleting = 0; deleting < 2; deleting++)
+		{
+			for (size_t i = 0; i < n; i++)
+			{
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				if (deleting) reb->DeleteNode(keys[i]);
+				else reb->InsertNode(keys[n + i]);
+				uint64_t ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+				latency[deleting].Record(ns);
+				if (ns > slowest[deleting]) slowest[deleting] = ns;
+			}
+		}
+		size_t pending = reb->Rebalance(0);
+		size_t burstDepth = reb->Validate().maxDepth;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		reb->SetRelaxedBalance(false);
+		chrono::duration<double, milli> rebalanceMs = chrono::steady_clock::now() - start;
+		printf("%-8s %9zu keys   insert %6.1f ns/op p99 %5llu max %7llu   delete %6.1f ns/op p99 %5llu max %7llu   %7zu pending, depth %zu -> %zu, Rebalance %7.1f ms\n",
+			relaxed ? "relaxed" : "eager", n,
+			(double)latency[0].totalNs / n, (unsigned long long)latency[0].QuantileNs(0.99), (unsigned long long)slowest[0],
+			(double)latency[1].totalNs / n, (unsigned long long)latency[1].QuantileNs(0.99), (unsigned long long)slowest[1],
+			pending, burstDepth, reb->Validate().maxDepth, rebalanceMs.count());
+		delete reb;
+	}
+}
+
+//cold start: n sorted keys inserted one by one against the linear bulk build
+static void MeasureBulkBuild(size_t n)
+{
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)(2 * i);
+
+	RedBlackTree<int> *reb = new RedBlackTree<int>();
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++) reb->InsertNode(keys[i]);
+	chrono::duration<double, milli> insertMs = chrono::steady_clock::now() - start;
+	delete reb;
+
+	start = chrono::steady_clock::now();
+	reb = new RedBlackTree<int>(keys.begin(), keys.end());
+	chrono::duration<double, milli> buildMs = chrono::steady_clock::now() - start;
+	printf("%12zu sorted keys   InsertNode loop %10.1f ms   BuildFromSorted %10.1f ms\n", n, insertMs.count(), buildMs.count());
+	reb->BlackHeightTraversal();
+	delete reb;
+}
+
+//k random keys inserted and deleted again on a tree of n keys, one by one against InsertBatch and DeleteBatch
+static void MeasureBatch(size_t n, size_t k)
+{
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)(2 * i);
+	vector<int> batch(k);
+	mt19937_64 generator(k);
+	for (size_t i = 0; i < k; i++) batch[i] = (int)(generator() % (2 * n + 2 * k));
+
+	RedBlackTree<int> *reb = new RedBlackTree<int>(keys.begin(), keys.end());
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t i = 0; i < k; i++) reb->InsertNode(batch[i]);
+	double insertNs = NsPerOp(start, k);
+	start = chrono::steady_clock::now();
+	for (size_t i = 0; i < k; i++) reb->DeleteNode(batch[i]);
+	double deleteNs = NsPerOp(start, k);
+	delete reb;
+
+	reb = new RedBlackTree<int>(keys.begin(), keys.end());
+	start = chrono::steady_clock::now();
+	reb->InsertBatch(batch.begin(), batch.end());
+	double insertBatchNs = NsPerOp(start, k);
+	start = chrono::steady_clock::now();
+	reb->DeleteBatch(batch.begin(), batch.end());
+	double deleteBatchNs = NsPerOp(start, k);
+	delete reb;
+
+	printf("%10zu keys batch %10zu   insert %8.1f -> %8.1f ns/key   delete %8.1f -> %8.1f ns/key\n", n, k, insertNs, insertBatchNs, deleteNs, deleteBatchNs);
+}
+
+static double MsSince(chrono::steady_clock::time_point start)
+{
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+//set operations of a tree of n random keys with one of m random keys against re-inserting or deleting one by one
+static void MeasureSetOperations(size_t n, size_t m)
+{
+	mt19937_64 generator(n + m);
+	vector<int> keys(n), otherKeys(m);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)(generator() % (4 * n));
+	for (size_t i = 0; i < m; i++) otherKeys[i] = (int)(generator() % (4 * n));
+	sort(keys.begin(), keys.end());
+	sort(otherKeys.begin(), otherKeys.end());
+
+	RedBlackTree<int> reb(keys.begin(), keys.end()), other(otherKeys.begin(), otherKeys.end());
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (RedBlackTree<int>::iterator it = other.begin(); it != other.end(); ++it) reb.InsertNode(*it);
+	double unionLoopMs = MsSince(start);
+	reb.BuildFromSorted(keys.begin(), keys.end());
+	start = chrono::steady_clock::now();
+	reb.Union(other);
+	double unionMs = MsSince(start);
+
+	reb.BuildFromSorted(keys.begin(), keys.end());
+	other.BuildFromSorted(otherKeys.begin(), otherKeys.end());
+	start = chrono::steady_clock::now();
+	for (RedBlackTree<int>::iterator it = other.begin(); it != other.end(); ++it) reb.DeleteNode(*it);
+	double differenceLoopMs = MsSince(start);
+	reb.BuildFromSorted(keys.begin(), keys.end());
+	start = chrono::steady_clock::now();
+	reb.Difference(other);
+	double differenceMs = MsSince(start);
+
+	reb.BuildFromSorted(keys.begin(), keys.end());
+	start = chrono::steady_clock::now();
+	reb.Intersection(other);
+	double intersectionMs = MsSince(start);
+
+	printf("%10zu keys with %10zu   union %9.2f -> %8.2f ms   difference %9.2f -> %8.2f ms   intersection %8.2f ms\n",
+		n, m, unionLoopMs, unionMs, differenceLoopMs, differenceMs, intersectionMs);
+}
+
+//cut a tree of n keys in the middle and put it back together, against moving the upper half one by one
+static void MeasureSplitJoin(size_t n)
+{
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)i;
+	RedBlackTree<int> reb(keys.begin(), keys.end()), upper;
+	int middle = (int)(n / 2);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int key = middle; key < (int)n; key++)
+	{
+		upper.InsertNode(key);
+		reb.DeleteNode(key);
+	}
+	double loopMs = MsSince(start);
+
+	reb.BuildFromSorted(keys.begin(), keys.end());
+	upper.ReleaseAll();
+	start = chrono::steady_clock::now();
+	reb.Split(middle, upper);
+	double splitUs = MsSince(start) * 1000;
+	start = chrono::steady_clock::now();
+	reb.Join(reb, upper);
+	double joinUs = MsSince(start) * 1000;
+	printf("%10zu keys   move upper half one by one %9.2f ms   Split %8.2f us   Join %8.2f us\n", n, loopMs, splitUs, joinUs);
+	reb.BlackHeightTraversal();
+}
+
+//a single mutex around every call, the way the tree has been shared between threads so far
+class LockedRedBlackTree
+{
+private:
+	mutex treeMutex;
+	RedBlackTree<int> tree;
+public:
+	template <class InputIterator> void InsertBatch(InputIterator first, InputIterator last)
+	{
+		lock_guard<mutex> lock(this->treeMutex);
+		this->tree.InsertBatch(first, last);
+	}
+	bool Contains(int key)
+	{
+		lock_guard<mutex> lock(this->treeMutex);
+		return this->tree.AccessNode(key) != NULL;
+	}
+	void InsertNode(int key)
+	{
+		lock_guard<mutex> lock(this->treeMutex);
+		this->tree.InsertNode(key);
+	}
+	void DeleteNode(int key)
+	{
+		lock_guard<mutex> lock(this->treeMutex);
+		this->tree.DeleteNode(key);
+	}
+};
+
+//threads running 95% lookups, 3% inserts and 2% deletes for a while, in million operations per second
+template <class Store> static double MeasureReadMostly(Store& store, size_t n, int threads, double seconds)
+{
+	atomic<bool> stop(false);
+	vector<size_t> operations(threads);
+	vector<thread> workers;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int t = 0; t < threads; t++)
+	{
+		workers.push_back(thread([&store, &stop, &operations, n, t]()
+		{
+			mt19937_64 generator(t + 1);
+			size_t done = 0;
+			while (!stop.load(memory_order_relaxed))
+			{
+				int key = (int)(generator() % (2 * n));
+				unsigned dice = (unsigned)(generator() % 100);
+				if (dice < 95) store.Contains(key);
+				else if (dice < 98) store.InsertNode(key);
+				else store.DeleteNode(key);
+				done++;
+			}
+			operations[t] = done;
+		}));
+	}
+	this_thread::sleep_for(chrono::duration<double>(seconds));
+	stop.store(true);
+	size_t total = 0;
+	for (int t = 0; t < threads; t++)
+	{
+		workers[t].join();
+		total += operations[t];
+	}
+	return total / (MsSince(start) * 1000);
+}
+
+static void MeasureConcurrency(size_t n)
+{
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)(2 * i);
+	LockedRedBlackTree locked;
+	ConcurrentRedBlackTree<int> concurrent;
+	locked.InsertBatch(keys.begin(), keys.end());
+	concurrent.InsertBatch(keys.begin(), keys.end());
+	printf("%zu keys, 95%% lookups, %u hardware threads\n", n, thread::hardware_concurrency());
+	for (int threads = 1; threads <= 64; threads *= 2)
+	{
+		double lockedRate = MeasureReadMostly(locked, n, threads, 0.5);
+		double concurrentRate = MeasureReadMostly(concurrent, n, threads, 0.5);
+		printf("%3d threads   global mutex %8.2f Mops/s   ConcurrentRedBlackTree %8.2f Mops/s\n", threads, lockedRate, concurrentRate);
+	}
+}
+
+//random lookups, half of them misses, in the live tree and in its frozen copy
+static void MeasureFrozen(size_t n)
+{
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)(2 * i);
+	RedBlackTree<int> reb(keys.begin(), keys.end());
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	FrozenRedBlackTree<int, less<int> > frozen = reb.Freeze();
+	double freezeMs = MsSince(start);
+	size_t lookups = max(n, (size_t)4000000);
+	vector<int> probes(lookups);
+	mt19937_64 generator(n);
+	for (size_t i = 0; i < lookups; i++) probes[i] = (int)(generator() % (2 * n));
+	size_t found = 0;
+	start = chrono::steady_clock::now();
+	for (size_t i = 0; i < lookups; i++) if (reb.AccessNode(probes[i]) != NULL) found++;
+	double liveNs = NsPerOp(start, lookups);
+	size_t frozenFound = 0;
+	start = chrono::steady_clock::now();
+	for (size_t i = 0; i < lookups; i++) if (frozen.AccessNode(probes[i]) != NULL) frozenFound++;
+	double frozenNs = NsPerOp(start, lookups);
+	printf("%10zu keys (%7.1f MB live, %7.1f MB frozen)   lookup: live %7.1f ns/op, frozen %7.1f ns/op   freeze %8.2f ms%s\n",
+		n, n * sizeof(RedBlackTree<int>::Node) / 1048576.0, n * sizeof(int) / 1048576.0, liveNs, frozenNs, freezeMs,
+		found == frozenFound ? "" : "   MISMATCH");
+}
+
+//the same lookups in the k-ary export: node search scalar and with SIMD, one by one and in batches
+static void MeasureStaticBTree(size_t n)
+{
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)(2 * i);
+	RedBlackTree<int> reb(keys.begin(), keys.end());
+	StaticBTree<int> btree = reb.ExportBTree();
+	size_t lookups = max(n, (size_t)4000000);
+	vector<int> probes(lookups);
+	mt19937_64 generator(n);
+	for (size_t i = 0; i < lookups; i++) probes[i] = (int)(generator() % (2 * n));
+	const char *names[] = { "scalar", "SSE4.2", "AVX2" };
+	SimdLevel detected = SimdSupport::Detected();
+	printf("%10zu keys   ", n);
+	for (int level = ScalarLevel; level <= detected; level++)
+	{
+		btree.SetSimdLevel((SimdLevel)level);
+		size_t found = 0;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (size_t i = 0; i < lookups; i++) if (btree.AccessNode(probes[i]) != NULL) found++;
+		printf("%s %6.1f ns/op   ", names[level], NsPerOp(start, lookups));
+	}
+	vector<const int*> results(lookups);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	btree.AccessBatch(probes.data(), lookups, results.data());
+	printf("%s AccessBatch %6.1f ns/op\n", names[btree.GetSimdLevel()], NsPerOp(start, lookups));
+}
+
+//startup from an image file against rebuilding the tree, then lookups through the mapping
+static void MeasureMappedImage(size_t n)
+{
+	const char *path = "TreeBenchZone.image";
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)(2 * i);
+	RedBlackTree<int> reb(keys.begin(), keys.end());
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	bool saved = MappedRedBlackTree<int>::Save(reb, path);
+	double saveMs = MsSince(start);
+	start = chrono::steady_clock::now();
+	RedBlackTree<int> rebuilt;
+	for (size_t i = 0; i < n; i++) rebuilt.InsertNode(keys[i]);
+	double rebuildMs = MsSince(start);
+	MappedRedBlackTree<int> mapped;
+	start = chrono::steady_clock::now();
+	bool opened = saved && mapped.Open(path);
+	double openMs = MsSince(start);
+	if (!opened)
+	{
+		printf("%10zu keys   could not write or open %s\n", n, path);
+		return;
+	}
+	mt19937_64 generator(n);
+	size_t lookups = 1000000;
+	size_t found = 0;
+	start = chrono::steady_clock::now();
+	for (size_t i = 0; i < lookups; i++) if (mapped.AccessNode((int)(generator() % (2 * n))) != NULL) found++;
+	double lookupNs = NsPerOp(start, lookups);
+	start = chrono::steady_clock::now();
+	RedBlackTree<int> thawed;
+	mapped.Thaw(thawed);
+	double thawMs = MsSince(start);
+	mapped.Close();
+	remove(path);
+	printf("%10zu keys   save %8.2f ms   open %8.3f ms (InsertNode rebuild %8.2f ms)   mapped lookup %7.1f ns/op (%zu found)   thaw %8.2f ms\n",
+		n, saveMs, openMs, rebuildMs, lookupNs, found, thawMs);
+}
+
+//a checkpoint stream of a tree and loading it back, then the cost of logging every change ahead
+static void MeasureStreaming(size_t n)
+{
+	const char *path = "TreeBenchZone.stream";
+	const char *logPath = "TreeBenchZone.log";
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)(3 * i);
+	RedBlackTree<int> reb(keys.begin(), keys.end());
+	TreeStreamWriter<int> writer;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	bool written = writer.Write(reb, path);
+	double writeMs = MsSince(start);
+	FILE *file = fopen(path, "rb");
+	long bytes = 0;
+	if (file != NULL)
+	{
+		fseek(file, 0, SEEK_END);
+		bytes = ftell(file);
+		fclose(file);
+	}
+	RedBlackTree<int> loaded;
+	start = chrono::steady_clock::now();
+	bool read = written && TreeStreamReader<int>::Load(loaded, path);
+	double loadMs = MsSince(start);
+	remove(path);
+	if (!read)
+	{
+		printf("%10zu keys   could not write or read %s\n", n, path);
+		return;
+	}
+	//what logging adds to every change
+	mt19937_64 generator(n);
+	size_t changes = 1000000;
+	TreeWriteAheadLog<int> log;
+	log.Open(logPath);
+	start = chrono::steady_clock::now();
+	for (size_t i = 0; i < changes; i++)
+	{
+		int value = (int)(generator() % (3 * n));
+		if (i % 2 == 0) log.LogInsert(value);
+		else log.LogDelete(value);
+	}
+	log.Flush();
+	double logNs = NsPerOp(start, changes);
+	log.Close();
+	remove(logPath);
+	printf("%10zu keys   stream %6.2f bytes/value   write %8.2f ms   load %8.2f ms   log append %6.1f ns/op\n",
+		n, (double)bytes / n, writeMs, loadMs, logNs);
+}
+
+//why a workload costs what it does - only with RED_BLACK_TREE_STATS, which adds its own timing to every operation
+static void PrintStats(const char *name, const RedBlackTreeStats& stats, size_t inserts, size_t deletes)
+{
+	printf("%-12s search %5.1f cmp   insert search %5.1f cmp   max depth %3llu   recolors %5.2f/insert %5.2f/delete\n", name,
+		stats.searches == 0 ? 0.0 : (double)stats.searchComparisons / stats.searches,
+		stats.insertSearches == 0 ? 0.0 : (double)stats.insertComparisons / stats.insertSearches, (unsigned long long)stats.maxDepth,
+		(double)stats.doubleRedRecolors / inserts, (double)stats.reducedHeightRecolors / deletes);
+	printf("%-12s rotations per 1000 ops:", "");
+	for (size_t i = 0; i < RedBlackTreeStats::Rotations; i++)
+	{
+		printf(" %s %.0f", RedBlackTreeStats::RotationName(i), 1000.0 * stats.rotations[i] / (inserts + deletes));
+	}
+	printf(" TopDown %.0f (recolors %.0f)", 1000.0 * stats.topDownRotations / (inserts + deletes), 1000.0 * stats.topDownRecolors / (inserts + deletes));
+	printf("\n%-12s latency p50/p99 ns: lookup %llu/%llu   insert %llu/%llu   delete %llu/%llu\n", "",
+		(unsigned long long)stats.lookupLatency.QuantileNs(0.5), (unsigned long long)stats.lookupLatency.QuantileNs(0.99),
+		(unsigned long long)stats.insertLatency.QuantileNs(0.5), (unsigned long long)stats.insertLatency.QuantileNs(0.99),
+		(unsigned long long)stats.deleteLatency.QuantileNs(0.5), (unsigned long long)stats.deleteLatency.QuantileNs(0.99));
+}
+static void MeasureStats(size_t n)
+{
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)i;
+	RedBlackTree<int> *reb = new RedBlackTree<int>();
+	for (size_t i = 0; i < n; i++) reb->InsertNode(keys[i]);
+	for (size_t i = 0; i < n; i++) reb->AccessNode(keys[i]);
+	for (size_t i = 0; i < n; i++) reb->DeleteNode(keys[i]);
+	PrintStats("sequential", reb->Stats(), n, n);
+
+	mt19937_64 generator(n);
+	shuffle(keys.begin(), keys.end(), generator);
+	reb->ResetStats();
+	for (size_t i = 0; i < n; i++) reb->InsertNode(keys[i]);
+	shuffle(keys.begin(), keys.end(), generator);
+	for (size_t i = 0; i < n; i++) reb->AccessNode(keys[i]);
+	shuffle(keys.begin(), keys.end(), generator);
+	for (size_t i = 0; i < n; i++) reb->DeleteNode(keys[i]);
+	PrintStats("random", reb->Stats(), n, n);
+
+	reb->ResetStats();
+	for (size_t i = 0; i < n; i++) reb->InsertNodeTopDown(keys[i]);
+	shuffle(keys.begin(), keys.end(), generator);
+	for (size_t i = 0; i < n; i++) reb->AccessNode(keys[i]);
+	shuffle(keys.begin(), keys.end(), generator);
+	for (size_t i = 0; i < n; i++) reb->DeleteNodeTopDown(keys[i]);
+	PrintStats("top-down", reb->Stats(), n, n);
+	delete reb;
+}
+
+//path copying against in place changes, and what a snapshot costs while a writer keeps going
+static void MeasureSnapshots(size_t n)
+{
+	vector<int> keys(n);
+	for (size_t i = 0; i < n; i++) keys[i] = (int)i;
+	shuffle(keys.begin(), keys.end(), mt19937_64(5));
+	RedBlackTree<int> reb;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++) reb.InsertNode(keys[i]);
+	double inPlaceNs = NsPerOp(start, n);
+	PersistentRedBlackTree<int> version;
+	size_t allocations = allocationCount;
+	start = chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++) version = version.InsertNode(keys[i]);
+	double persistentNs = NsPerOp(start, n);
+	double allocationsPerInsert = (double)(allocationCount - allocations) / n;
+	//a snapshot every 1024 changes, all of them kept alive
+	vector<PersistentRedBlackTree<int> > snapshots;
+	start = chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++)
+	{
+		if (i % 1024 == 0) snapshots.push_back(version.Snapshot());
+		version = version.DeleteNode(keys[i]);
+	}
+	double deleteNs = NsPerOp(start, n);
+	size_t kept = snapshots.size();
+	snapshots.reserve(2 * kept);
+	start = chrono::steady_clock::now();
+	for (size_t i = 0; i < kept; i++) snapshots.push_back(snapshots[i].Snapshot());
+	double snapshotNs = NsPerOp(start, kept);
+	printf("%zu keys   insert: in place %7.1f ns/op, path copying %7.1f ns/op (%.1f allocations)   delete %7.1f ns/op   snapshot %5.1f ns\n",
+		n, inPlaceNs, persistentNs, allocationsPerInsert, deleteNs, snapshotNs);
+}
+
+//inserts n values through one of the insertion entry points and reports the cost per insert
+template <class T, class Insertion> static void MeasureHeavyInsert(const char *name, size_t n, Insertion insertion)
+{
+	RedBlackTree<T> reb;
+	size_t allocations = allocationCount;
+	size_t copies = Payload64::copies;
+	size_t moves = Payload64::moves;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++) insertion(reb, i);
+	double insertNs = NsPerOp(start, n);
+	printf("%-36s insert %8.1f ns/op   %5.2f allocations   %5.2f copies   %5.2f moves per insert\n", name, insertNs,
+		(double)(allocationCount - allocations) / n, (double)(Payload64::copies - copies) / n, (double)(Payload64::moves - moves) / n);
+}
+
+static void MeasureHeavyValues(size_t n)
+{
+	//keys long enough to live on the heap
+	vector<string> keys(n);
+	mt19937_64 generator(n);
+	for (size_t i = 0; i < n; i++) keys[i] = "key-" + to_string(generator()) + "-beyond-small-string-buffer";
+	vector<string> movableKeys(keys);
+	MeasureHeavyInsert<string>("string     InsertNode(const T&)", n, [&](RedBlackTree<string>& reb, size_t i) { reb.InsertNode(keys[i]); });
+	MeasureHeavyInsert<string>("string     Insert(T&&)", n, [&](RedBlackTree<string>& reb, size_t i) { reb.Insert(move(movableKeys[i])); });
+	MeasureHeavyInsert<string>("string     Emplace(const char*)", n, [&](RedBlackTree<string>& reb, size_t i) { reb.Emplace(keys[i].c_str()); });
+
+	vector<Payload64> payloads;
+	payloads.reserve(n);
+	for (size_t i = 0; i < n; i++) payloads.push_back(Payload64((long long)generator()));
+	MeasureHeavyInsert<Payload64>("Payload64  InsertNode(const T&)", n, [&](RedBlackTree<Payload64>& reb, size_t i) { reb.InsertNode(payloads[i]); });
+	MeasureHeavyInsert<Payload64>("Payload64  Insert(T&&)", n, [&](RedBlackTree<Payload64>& reb, size_t i) { reb.Insert(move(payloads[i])); });
+	MeasureHeavyInsert<Payload64>("Payload64  Emplace(long long)", n, [&](RedBlackTree<Payload64>& reb, size_t i) { reb.Emplace(payloads[i].key); });
+}
+
+int main(int argc, char **argv)
+{
+	cout << "Tree Bench Zone \n-----------------\n\n";
+	bool full = argc > 1 && strcmp(argv[1], "full") == 0;
+	printf("node size: int %zu, long long %zu, double %zu bytes\n\n",
+		RBNodeSizeReport<int>::actual, RBNodeSizeReport<long long>::actual, RBNodeSizeReport<double>::actual);
+	MeasureInsertAndLookup(1000000);
+	MeasureInsertAndLookup(10000000);
+	if (full) MeasureInsertAndLookup(100000000);
+	cout << "\n";
+	MeasureChurn<RedBlackTree<int> >("std::allocator", 1000000);
+	MeasureChurn<RedBlackTree<int, less<int>, PoolAllocator<int> > >("PoolAllocator", 1000000);
+	MeasureChurn<RedBlackTree<int> >("std::allocator", 10000000);
+	MeasureChurn<RedBlackTree<int, less<int>, PoolAllocator<int> > >("PoolAllocator", 10000000);
+	cout << "\n";
+	MeasureHeavyValues(1000000);
+	cout << "\n";
+	for (size_t n = 1000000; n <= 10000000; n *= 10)
+	{
+		MeasureTopDown<RedBlackTree<int> >("std::allocator", n, false);
+		MeasureTopDown<RedBlackTree<int> >("std::allocator", n, true);
+		MeasureTopDown<RedBlackTree<int, less<int>, allocator<int>, OrderStatistics> >("OrderStatistics", n, true);
+	}
+	cout << "\n";
+	MeasureRelaxedBalance(1000000);
+	MeasureRelaxedBalance(10000000);
+	cout << "\n";
+	MeasureBulkBuild(1000000);
+	MeasureBulkBuild(10000000);
+	cout << "\n";
+	for (size_t k = 1000; k <= 10000000; k *= 10) MeasureBatch(1000000, k);
+	cout << "\n";
+	for (size_t m = 1000; m <= 1000000; m *= 10) MeasureSetOperations(1000000, m);
+	MeasureSplitJoin(1000000);
+	MeasureSplitJoin(10000000);
+	cout << "\n";
+	MeasureConcurrency(1000000);
+	cout << "\n";
+	MeasureSnapshots(1000000);
+	cout << "\n";
+	//from L2 resident to well past the last level cache
+	for (size_t n = 16384; n <= 4194304; n *= 16) MeasureFrozen(n);
+	if (full) MeasureFrozen(33554432);
+	for (size_t n = 16384; n <= 4194304; n *= 16) MeasureStaticBTree(n);
+	if (full) MeasureStaticBTree(33554432);
+	cout << "\n";
+	MeasureMappedImage(1000000);
+	MeasureMappedImage(10000000);
+	MeasureStreaming(1000000);
+	MeasureStreaming(10000000);
+	if (RedBlackTreeStats::Enabled)
+	{
+		cout << "\n";
+		MeasureStats(1000000);
+	}
+	return 0;
+}
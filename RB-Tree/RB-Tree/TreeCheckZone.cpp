@@ -0,0 +1,1020 @@
+/* TreeCheckZone.cpp :
+this short code checks the features built on top of the tree against std::set and std::map, or by round trips
+every check starts from its own fixed seed, prints the first difference it finds and the exit code tells whether all passed
+run with the name of a check as argument to run only that one
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <vector>
+#include <set>
+#include <map>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <limits>
+#include "RedBlackTree.h"
+#include "RedBlackMap.h"
+#include "ConcurrentRedBlackTree.h"
+#include "PersistentRedBlackTree.h"
+#include "FrozenRedBlackTree.h"
+#include "StaticBTree.h"
+#include "MappedRedBlackTree.h"
+#include "TreeStream.h"
+
+using namespace std;
+
+static bool Fail(const string& problem)
+{
+	printf("   %s\n", problem.c_str());
+	return false;
+}
+
+//full comparison of an in-order range with the reference, O(n)
+template <class Iterator, class Reference> static bool SameContents(Iterator first, Iterator last, const Reference& reference)
+{
+	typename Reference::const_iterator expected = reference.begin();
+	for (; first != last; ++first, ++expected)
+	{
+		if (expected == reference.end() || !(*first == *expected)) return false;
+	}
+	return expected == reference.end();
+}
+
+//random updates through every kind of insertion against std::map, then ordered traversal and range scans
+static bool CheckMap()
+{
+	mt19937_64 generator(6);
+	RedBlackMap<int, int> reb;
+	map<int, int> reference;
+	for (int step = 0; step < 20000; step++)
+	{
+		int key = (int)(generator() % 2000);
+		int value = (int)(generator() % 1000);
+		switch (generator() % 6)
+		{
+		case 0:
+			reb[key] = value;
+			reference[key] = value;
+			break;
+		case 1:
+			if (reb.insert_or_assign(key, value).second != (reference.count(key) == 0)) return Fail("insert_or_assign reports a wrong insertion");
+			reference[key] = value;
+			break;
+		case 2:
+			if (reb.try_emplace(key, value).second != reference.insert(make_pair(key, value)).second) return Fail("try_emplace reports a wrong insertion");
+			break;
+		case 3:
+			reb.InsertNode(key, value);
+			reference.insert(make_pair(key, value));
+			break;
+		case 4:
+			reb.DeleteNode(key);
+			reference.erase(key);
+			break;
+		default:
+			{
+				int* mapped = reb.AccessValue(key);
+				map<int, int>::iterator expected = reference.find(key);
+				if ((mapped != NULL) != (expected != reference.end())) return Fail("AccessValue differs from std::map");
+				if (mapped != NULL && *mapped != expected->second) return Fail("AccessValue found another value");
+			}
+		}
+	}
+	if (!SameContents(reb.begin(), reb.end(), reference)) return Fail("traversal differs from std::map");
+	//updates through the iterator, then backwards
+	for (RedBlackMap<int, int>::Iterator it = reb.begin(); it != reb.end(); ++it) it->second++;
+	map<int, int>::reverse_iterator expected = reference.rbegin();
+	for (RedBlackMap<int, int>::Iterator it = reb.end(); it != reb.begin(); ++expected)
+	{
+		--it;
+		if (expected == reference.rend() || it->first != expected->first || it->second != expected->second + 1) return Fail("backward traversal differs from std::map");
+	}
+	for (int key = -1; key <= 2001; key++)
+	{
+		map<int, int>::iterator lower = reference.lower_bound(key), upper = reference.upper_bound(key);
+		RedBlackMap<int, int>::Iterator rebLower = reb.lower_bound(key), rebUpper = reb.upper_bound(key);
+		if ((rebLower == reb.end()) != (lower == reference.end()) || (lower != reference.end() && rebLower->first != lower->first)) return Fail("lower_bound differs from std::map");
+		if ((rebUpper == reb.end()) != (upper == reference.end()) || (upper != reference.end() && rebUpper->first != upper->first)) return Fail("upper_bound differs from std::map");
+	}
+	return true;
+}
+
+//a random tree of keys below limit and the same keys in std::set
+template <class Tree> static void FillRandom(Tree& reb, set<int>& reference, size_t n, int limit, uint64_t seed)
+{
+	mt19937_64 generator(seed);
+	for (size_t i = 0; i < n; i++)
+	{
+		int key = (int)(generator() % limit);
+		reb.InsertNode(key);
+		reference.insert(key);
+	}
+}
+
+//forward and backward traversal and the bounds at every key, the empty tree included
+static bool CheckIterators()
+{
+	RedBlackTree<int> reb;
+	set<int> reference;
+	if (reb.begin() != reb.end() || reb.lower_bound(0) != reb.end()) return Fail("empty tree has values");
+	FillRandom(reb, reference, 5000, 10000, 7);
+	if (!SameContents(reb.begin(), reb.end(), reference)) return Fail("traversal differs from std::set");
+	if ((size_t)distance(reb.begin(), reb.end()) != reference.size()) return Fail("distance differs from the size");
+	set<int>::reverse_iterator expected = reference.rbegin();
+	for (RedBlackTree<int>::Iterator it = reb.end(); it != reb.begin(); ++expected)
+	{
+		--it;
+		if (expected == reference.rend() || *it != *expected) return Fail("backward traversal differs from std::set");
+	}
+	for (int key = -1; key <= 10000; key++)
+	{
+		set<int>::iterator lower = reference.lower_bound(key), upper = reference.upper_bound(key);
+		pair<RedBlackTree<int>::Iterator, RedBlackTree<int>::Iterator> range = reb.equal_range(key);
+		if ((range.first == reb.end()) != (lower == reference.end()) || (lower != reference.end() && *range.first != *lower)) return Fail("lower_bound differs from std::set");
+		if ((range.second == reb.end()) != (upper == reference.end()) || (upper != reference.end() && *range.second != *upper)) return Fail("upper_bound differs from std::set");
+		if (range.first != reb.lower_bound(key) || range.second != reb.upper_bound(key)) return Fail("equal_range differs from the bounds");
+	}
+	//a range scan stays valid while values outside of it are deleted
+	RedBlackTree<int>::Iterator it = reb.lower_bound(5000);
+	for (int key = 0; key < 5000; key++)
+	{
+		reb.DeleteNode(key);
+		reference.erase(key);
+	}
+	if (!SameContents(it, reb.end(), reference) || !SameContents(reb.begin(), reb.end(), reference)) return Fail("scan differs after deleting before it");
+	return true;
+}
+
+typedef RedBlackTree<int, less<int>, allocator<int>, OrderStatistics> RankedTree;
+
+//Size, Select, Rank and CountRange after random insertions and deletions of both kinds
+static bool CheckOrderStatistics()
+{
+	mt19937_64 generator(8);
+	RankedTree reb;
+	set<int> reference;
+	for (int step = 0; step < 20000; step++)
+	{
+		int key = (int)(generator() % 5000);
+		bool topDown = generator() % 2 == 0;
+		if (generator() % 3 != 0)
+		{
+			if (topDown) reb.InsertNodeTopDown(key);
+			else reb.InsertNode(key);
+			reference.insert(key);
+		}
+		else
+		{
+			if (topDown) reb.DeleteNodeTopDown(key);
+			else reb.DeleteNode(key);
+			reference.erase(key);
+		}
+	}
+	if (!reb.Validate().IsValid()) return Fail("subtree sizes broken: " + reb.Validate().firstViolation);
+	if (reb.Size() != reference.size()) return Fail("Size differs from std::set");
+	size_t k = 0;
+	for (set<int>::iterator it = reference.begin(); it != reference.end(); ++it, k++)
+	{
+		RankedTree::Node* node = reb.Select(k);
+		if (node == NULL || node->GetValue() != *it) return Fail("Select(" + to_string(k) + ") differs from std::set");
+	}
+	if (reb.Select(k) != NULL) return Fail("Select past the end found a value");
+	for (int key = -1; key <= 5000; key++)
+	{
+		if (reb.Rank(key) != (size_t)distance(reference.begin(), reference.lower_bound(key))) return Fail("Rank(" + to_string(key) + ") differs from std::set");
+	}
+	for (int i = 0; i < 1000; i++)
+	{
+		int low = (int)(generator() % 5200) - 100, high = (int)(generator() % 5200) - 100;
+		size_t expected = low < high ? (size_t)distance(reference.lower_bound(low), reference.lower_bound(high)) : 0;
+		if (reb.CountRange(low, high) != expected) return Fail("CountRange differs from std::set");
+	}
+	return true;
+}
+
+//Aggregate over random ranges against a plain fold of std::set, after updates that rotate, relaxed ones and a split
+template <class Monoid> static bool CheckAggregate(const char* name, uint64_t seed)
+{
+	typedef RedBlackTree<int, less<int>, allocator<int>, MonoidAugment<Monoid> > Tree;
+	mt19937_64 generator(seed);
+	Tree reb;
+	set<int> reference;
+	for (int step = 0; step < 20000; step++)
+	{
+		int key = (int)(generator() % 5000) - 2500;
+		if (step == 10000) reb.SetRelaxedBalance(true);
+		if (step == 15000) reb.SetRelaxedBalance(false);
+		if (generator() % 3 != 0)
+		{
+			reb.InsertNode(key);
+			reference.insert(key);
+		}
+		else
+		{
+			reb.DeleteNode(key);
+			reference.erase(key);
+		}
+	}
+	Tree right;
+	reb.Split(0, right);
+	for (int round = 0; round < 2; round++)
+	{
+		//the split tree on the second round, the joined one of both halves on the first
+		if (round == 1) reb.Split(0, right);
+		else reb.Join(reb, right);
+		for (int i = 0; i < 2000; i++)
+		{
+			int low = (int)(generator() % 5200) - 2600, high = (int)(generator() % 5200) - 2600;
+			typename Monoid::ValueType expected = Monoid::Identity();
+			for (set<int>::iterator it = reference.lower_bound(low); low < high && it != reference.end() && *it < high; ++it)
+			{
+				if (round == 0 || *it < 0) expected = Monoid::Combine(expected, Monoid::Lift(*it));
+			}
+			if (reb.Aggregate(low, high) != expected) return Fail(string(name) + " aggregate over [" + to_string(low) + ", " + to_string(high) + ") differs");
+		}
+	}
+	return true;
+}
+static bool CheckMonoidAugment()
+{
+	return CheckAggregate<SumMonoid<int, long long> >("sum", 9) && CheckAggregate<MinMonoid<int> >("min", 10)
+		&& CheckAggregate<MaxMonoid<int> >("max", 11);
+}
+
+//every small size and a large one, with repeated values, then updates on the built tree reusing the freed nodes of its block
+template <class Tree> static bool CheckBuild(const char* name)
+{
+	mt19937_64 generator(10);
+	for (size_t n = 0; n <= 300; n++)
+	{
+		vector<int> values;
+		for (size_t i = 0; i < n; i++) values.push_back((int)(generator() % (n + 1)));
+		sort(values.begin(), values.end());
+		set<int> reference(values.begin(), values.end());
+		Tree reb(values.begin(), values.end());
+		RedBlackTreeReport report = reb.Validate();
+		if (!report.IsValid()) return Fail(string(name) + " build of " + to_string(n) + " values broken: " + report.firstViolation);
+		if (!SameContents(reb.begin(), reb.end(), reference)) return Fail(string(name) + " build of " + to_string(n) + " values differs from std::set");
+		for (size_t i = 0; i < 2 * n; i++)
+		{
+			int key = (int)(generator() % (n + 1));
+			if (generator() % 2 == 0)
+			{
+				reb.DeleteNode(key);
+				reference.erase(key);
+			}
+			else
+			{
+				reb.InsertNode(key);
+				reference.insert(key);
+			}
+		}
+		if (!reb.Validate().IsValid() || !SameContents(reb.begin(), reb.end(), reference)) return Fail(string(name) + " updates after a build differ from std::set");
+		//a rebuild replaces the contents
+		reb.BuildFromSorted(values.begin(), values.begin() + n / 2);
+		reference = set<int>(values.begin(), values.begin() + n / 2);
+		if (!reb.Validate().IsValid() || !SameContents(reb.begin(), reb.end(), reference)) return Fail(string(name) + " rebuild differs from std::set");
+	}
+	vector<int> large(200000);
+	for (size_t i = 0; i < large.size(); i++) large[i] = (int)(3 * i);
+	Tree reb(large.begin(), large.end());
+	if (!reb.Validate().IsValid() || !SameContents(reb.begin(), reb.end(), large)) return Fail(string(name) + " large build differs");
+	return true;
+}
+static bool CheckBuildFromSorted()
+{
+	return CheckBuild<RedBlackTree<int> >("plain") && CheckBuild<RankedTree>("OrderStatistics")
+		&& CheckBuild<RedBlackTree<int, less<int>, PoolAllocator<int> > >("PoolAllocator");
+}
+
+//batches of every size against std::set - small ones take the finger path, big ones the merge
+//either way a value that stays keeps its node, so pointers taken before the batch still find it
+template <class Tree> static bool CheckBatchOf(const char* name, bool relaxed)
+{
+	mt19937_64 generator(11);
+	Tree reb;
+	reb.SetRelaxedBalance(relaxed);
+	set<int> reference;
+	for (int round = 0; round < 300; round++)
+	{
+		size_t n = (size_t)1 << (generator() % 12);
+		int limit = (int)(generator() % 20000) + 10;
+		vector<int> batch;
+		for (size_t i = 0; i < n; i++) batch.push_back((int)(generator() % limit));
+		map<int, typename Tree::Node*> nodes;
+		for (typename Tree::Iterator it = reb.begin(); it != reb.end(); ++it) nodes[*it] = it.GetNode();
+		size_t expected = 0;
+		if (generator() % 3 != 0)
+		{
+			for (size_t i = 0; i < batch.size(); i++) expected += reference.count(batch[i]) == 0 && find(batch.begin(), batch.begin() + i, batch[i]) == batch.begin() + i;
+			size_t inserted = round % 2 == 0 ? reb.InsertBatch(batch.begin(), batch.end()) : reb.InsertBatch(batch.data(), batch.size());
+			if (inserted != expected) return Fail(string(name) + " InsertBatch count differs");
+			reference.insert(batch.begin(), batch.end());
+		}
+		else
+		{
+			for (size_t i = 0; i < batch.size(); i++) expected += reference.erase(batch[i]);
+			size_t removed = round % 2 == 0 ? reb.DeleteBatch(batch.begin(), batch.end()) : reb.DeleteBatch(batch.data(), batch.size());
+			if (removed != expected) return Fail(string(name) + " DeleteBatch count differs");
+		}
+		RedBlackTreeReport report = reb.Validate();
+		if (!report.IsValid()) return Fail(string(name) + " batch broke the tree: " + report.firstViolation);
+		if (!SameContents(reb.begin(), reb.end(), reference)) return Fail(string(name) + " batch differs from std::set");
+		for (typename map<int, typename Tree::Node*>::iterator it = nodes.begin(); it != nodes.end(); ++it)
+		{
+			if (reference.count(it->first) != 0 && reb.AccessNode(it->first) != it->second) return Fail(string(name) + " batch moved the node of a value that stayed");
+		}
+	}
+	return true;
+}
+static bool CheckBatch()
+{
+	return CheckBatchOf<RedBlackTree<int> >("plain", false) && CheckBatchOf<RankedTree>("OrderStatistics", false)
+		&& CheckBatchOf<RedBlackTree<int, less<int>, PoolAllocator<int> > >("relaxed PoolAllocator", true);
+}
+
+//split and join at random keys and the three set operations against the std algorithms, on trees of very different sizes
+//with equal allocators the nodes move between the trees, with unequal ones the values are copied into new nodes
+template <class Tree, class Alloc> static bool CheckSetOperationsOf(const char* name, bool sharedAllocator)
+{
+	mt19937_64 generator(12);
+	Alloc alloc;
+	for (int round = 0; round < 300; round++)
+	{
+		Tree a(less<int>(), alloc), b(less<int>(), sharedAllocator ? alloc : Alloc());
+		set<int> left, right;
+		int limit = (int)(generator() % 10000) + 1;
+		FillRandom(a, left, generator() % ((size_t)1 << (generator() % 13)), limit, generator());
+		FillRandom(b, right, generator() % ((size_t)1 << (generator() % 13)), limit, generator());
+		vector<int> expected;
+		if (round % 3 == 0)
+		{
+			set_union(left.begin(), left.end(), right.begin(), right.end(), back_inserter(expected));
+			a.Union(b);
+			if (b.begin() != b.end()) return Fail(string(name) + " Union left the other tree with values");
+		}
+		else if (round % 3 == 1)
+		{
+			set_intersection(left.begin(), left.end(), right.begin(), right.end(), back_inserter(expected));
+			a.Intersection(b);
+		}
+		else
+		{
+			set_difference(left.begin(), left.end(), right.begin(), right.end(), back_inserter(expected));
+			a.Difference(b);
+		}
+		if (round % 3 != 0 && !SameContents(b.begin(), b.end(), right)) return Fail(string(name) + " set operation changed the other tree");
+		if (!a.Validate().IsValid() || !SameContents(a.begin(), a.end(), expected)) return Fail(string(name) + " set operation " + to_string(round % 3) + " differs from the std algorithm");
+		//split at a key and join back, with and without a pivot
+		set<int> reference(expected.begin(), expected.end());
+		int key = (int)(generator() % (limit + 2)) - 1;
+		a.Split(key, b);
+		if (!a.Validate().IsValid() || !b.Validate().IsValid()) return Fail(string(name) + " Split broke a tree");
+		if (!SameContents(a.begin(), a.end(), set<int>(reference.begin(), reference.lower_bound(key)))
+			|| !SameContents(b.begin(), b.end(), set<int>(reference.lower_bound(key), reference.end()))) return Fail(string(name) + " Split differs from std::set");
+		Tree joined(less<int>(), alloc);
+		if (generator() % 2 == 0) joined.Join(a, b);
+		else
+		{
+			b.DeleteNode(key);
+			reference.insert(key);
+			joined.Join(a, key, b);
+		}
+		if (a.begin() != a.end() || b.begin() != b.end()) return Fail(string(name) + " Join left values behind");
+		if (!joined.Validate().IsValid() || !SameContents(joined.begin(), joined.end(), reference)) return Fail(string(name) + " Join differs from std::set");
+	}
+	return true;
+}
+static bool CheckSetOperations()
+{
+	typedef RedBlackTree<int, less<int>, PoolAllocator<int> > PoolTree;
+	return CheckSetOperationsOf<RedBlackTree<int>, allocator<int> >("plain", true) && CheckSetOperationsOf<RankedTree, allocator<int> >("OrderStatistics", true)
+		&& CheckSetOperationsOf<PoolTree, PoolAllocator<int> >("shared PoolAllocator", true) && CheckSetOperationsOf<PoolTree, PoolAllocator<int> >("unequal PoolAllocator", false);
+}
+
+//readers run lookups and scans while one writer changes the tree: keys below Stable are never touched,
+//keys above Growing only ever get inserted in increasing order, so no reader may miss one it has seen before
+static bool CheckConcurrent()
+{
+	const int Stable = 10000, Growing = 20000, Count = 20000, Scanned = 500;
+	ConcurrentRedBlackTree<int> reb;
+	set<int> reference;
+	vector<int> stable;
+	for (int key = 0; key < Stable; key += 2) stable.push_back(key);
+	reb.InsertBatch(stable.data(), stable.size());
+	reference.insert(stable.begin(), stable.end());
+	atomic<bool> done(false);
+	atomic<int> failures(0), reads(0);
+	vector<thread> readers;
+	for (int r = 0; r < 3; r++)
+	{
+		readers.push_back(thread([&reb, &done, &failures, &reads, r, Stable, Growing, Scanned]()
+		{
+			mt19937_64 generator(r);
+			int seen = Growing - 1;
+			while (!done.load())
+			{
+				int key = 2 * (int)(generator() % (Stable / 2)), value = -1;
+				if (!reb.Contains(key) || !reb.Find(key, value) || value != key) failures++;
+				if (seen >= Growing && !reb.Contains(seen)) failures++;
+				if (reb.Contains(seen + 1)) seen++;
+				//a scan sees one consistent version: all stable keys at its start, in order
+				size_t stableCount = reb.Read([Scanned](ConcurrentRedBlackTree<int>::Tree& tree)
+				{
+					size_t count = 0;
+					int previous = -1;
+					for (ConcurrentRedBlackTree<int>::Tree::Iterator it = tree.begin(); it != tree.end() && *it < Scanned; ++it)
+					{
+						if (*it <= previous) return (size_t)0;
+						previous = *it;
+						count += *it % 2 == 0;
+					}
+					return count;
+				});
+				if (stableCount != Scanned / 2) failures++;
+				//the writer waits for readers to leave, which takes long on a single core without this
+				reads++;
+				this_thread::yield();
+			}
+		}));
+	}
+	mt19937_64 generator(13);
+	for (int step = 0; step < Count; step++)
+	{
+		reb.InsertNode(Growing + step);
+		reference.insert(Growing + step);
+		//odd keys among the stable ones churn, singly and in batches
+		int key = 2 * (int)(generator() % (Stable / 2)) + 1;
+		if (step % 100 == 0)
+		{
+			vector<int> batch;
+			for (int i = 0; i < 50; i++) batch.push_back(key + 2 * i < Stable ? key + 2 * i : key);
+			if (step % 200 == 0)
+			{
+				reb.InsertBatch(batch.begin(), batch.end());
+				reference.insert(batch.begin(), batch.end());
+			}
+			else
+			{
+				reb.DeleteBatch(batch.begin(), batch.end());
+				for (size_t i = 0; i < batch.size(); i++) reference.erase(batch[i]);
+			}
+		}
+		else if (generator() % 2 == 0)
+		{
+			reb.InsertNode(key);
+			reference.insert(key);
+		}
+		else
+		{
+			reb.DeleteNode(key);
+			reference.erase(key);
+		}
+		this_thread::yield();
+	}
+	done.store(true);
+	for (size_t i = 0; i < readers.size(); i++) readers[i].join();
+	if (failures.load() != 0) return Fail(to_string(failures.load()) + " of " + to_string(reads.load()) + " reads saw an inconsistent tree");
+	if (reads.load() == 0) return Fail("the readers never ran");
+	//both copies end up the same, an empty change switches the readers over to the other one
+	for (int copy = 0; copy < 2; copy++)
+	{
+		bool same = reb.Read([&reference](ConcurrentRedBlackTree<int>::Tree& tree) { return tree.Validate().IsValid() && SameContents(tree.begin(), tree.end(), reference); });
+		if (!same) return Fail("copy " + to_string(copy) + " differs from std::set");
+		reb.Write([](ConcurrentRedBlackTree<int>::Tree&) {});
+	}
+	return true;
+}
+
+//black height of a persistent subtree, 0 if a red node has a red child or two paths differ
+static size_t PersistentBlackHeight(const PersistentRBNode<int>* node)
+{
+	if (node == NULL) return 1;
+	if (node->IsRed() && ((node->GetLeft() != NULL && node->GetLeft()->IsRed()) || (node->GetRight() != NULL && node->GetRight()->IsRed()))) return 0;
+	size_t left = PersistentBlackHeight(node->GetLeft()), right = PersistentBlackHeight(node->GetRight());
+	if (left == 0 || left != right) return 0;
+	return left + !node->IsRed();
+}
+
+//every kept snapshot still holds exactly the values of its time, and a handle outlives the version it came from
+//then readers copy and search a handle one writer keeps publishing new versions into
+static bool CheckPersistent()
+{
+	typedef PersistentRedBlackTree<int> Tree;
+	mt19937_64 generator(14);
+	Tree version;
+	set<int> reference;
+	vector<pair<Tree, set<int> > > snapshots;
+	for (int step = 0; step < 20000; step++)
+	{
+		if (step % 1000 == 0) snapshots.push_back(make_pair(version.Snapshot(), reference));
+		int key = (int)(generator() % 3000);
+		if (generator() % 3 != 0)
+		{
+			version = version.InsertNode(key);
+			reference.insert(key);
+		}
+		else
+		{
+			version = version.DeleteNode(key);
+			reference.erase(key);
+		}
+	}
+	snapshots.push_back(make_pair(version, reference));
+	for (size_t i = 0; i < snapshots.size(); i++)
+	{
+		Tree& snapshot = snapshots[i].first;
+		if (!SameContents(snapshot.begin(), snapshot.end(), snapshots[i].second)) return Fail("snapshot " + to_string(i) + " differs from the std::set of its time");
+		//the root is not public, but it is the node of one of the values
+		for (set<int>::iterator it = snapshots[i].second.begin(); it != snapshots[i].second.end(); ++it)
+		{
+			if (PersistentBlackHeight(snapshot.AccessNode(*it).get()) == 0) return Fail("snapshot " + to_string(i) + " is no red-black tree");
+		}
+		for (int key = 0; key < 3000; key += 7)
+		{
+			if ((snapshot.AccessNode(key) != NULL) != (snapshots[i].second.count(key) != 0)) return Fail("AccessNode in snapshot " + to_string(i) + " differs");
+		}
+	}
+	Tree::NodeHandle handle = version.AccessNode(*reference.begin());
+	version = Tree();
+	snapshots.clear();
+	if (handle == NULL || handle->GetValue() != *reference.begin()) return Fail("handle lost its node with the version");
+
+	const int Count = 20000;
+	Tree current;
+	atomic<bool> done(false);
+	atomic<int> failures(0), reads(0);
+	vector<thread> readers;
+	for (int r = 0; r < 3; r++)
+	{
+		readers.push_back(thread([&current, &done, &failures, &reads]()
+		{
+			int seen = 0;
+			while (!done.load())
+			{
+				//keys only ever get inserted in increasing order: a snapshot holds 0 .. m - 1 for some m no less than before
+				Tree snapshot = current;
+				int count = 0;
+				for (Tree::Iterator it = snapshot.begin(); it != snapshot.end(); ++it, count++)
+				{
+					if (*it != count) failures++;
+				}
+				if (count < seen) failures++;
+				seen = count;
+				Tree::NodeHandle node = current.AccessNode(seen / 2);
+				if (seen > 0 && (node == NULL || node->GetValue() != seen / 2)) failures++;
+				reads++;
+				this_thread::yield();
+			}
+		}));
+	}
+	for (int key = 0; key < Count; key++)
+	{
+		current = current.InsertNode(key);
+		if (key % 64 == 0) this_thread::yield();
+	}
+	done.store(true);
+	for (size_t i = 0; i < readers.size(); i++) readers[i].join();
+	if (failures.load() != 0) return Fail(to_string(failures.load()) + " of " + to_string(reads.load()) + " reads saw an inconsistent version");
+	int count = 0;
+	for (Tree::Iterator it = current.begin(); it != current.end(); ++it) count += *it == count;
+	if (count != Count) return Fail("published version lost values");
+	return true;
+}
+
+//every stored value is found and every gap between two of them, below and above them all is not
+template <class Value> static bool CheckFrozenOf(const char* name, RedBlackTree<Value>& reb, const set<Value>& reference, const vector<Value>& missing)
+{
+	FrozenRedBlackTree<Value, less<Value> > frozen = reb.Freeze();
+	if (frozen.Size() != reference.size() || frozen.IsEmpty() != reference.empty()) return Fail(string(name) + " frozen size differs");
+	for (typename set<Value>::const_iterator it = reference.begin(); it != reference.end(); ++it)
+	{
+		const Value* found = frozen.AccessNode(*it);
+		if (found == NULL || *found != *it) return Fail(string(name) + " frozen tree of " + to_string(reference.size()) + " lost a value");
+	}
+	for (size_t i = 0; i < missing.size(); i++)
+	{
+		if ((frozen.AccessNode(missing[i]) != NULL) != (reference.count(missing[i]) != 0)) return Fail(string(name) + " frozen tree of " + to_string(reference.size()) + " found a missing value");
+	}
+	//copies and moves keep the aligned layout working
+	FrozenRedBlackTree<Value, less<Value> > copy(frozen);
+	FrozenRedBlackTree<Value, less<Value> > moved(move(frozen));
+	if (!reference.empty() && (copy.AccessNode(*reference.rbegin()) == NULL || moved.AccessNode(*reference.begin()) == NULL)) return Fail(string(name) + " copied frozen tree lost a value");
+	return true;
+}
+//every small size, where the Eytzinger layout ends in all kinds of partial levels, and large ones where the prefetching runs ahead
+static bool CheckFrozen()
+{
+	mt19937_64 generator(15);
+	for (size_t n = 0; n <= 300; n++)
+	{
+		RedBlackTree<int> reb;
+		set<int> reference;
+		for (size_t i = 0; i < n; i++)
+		{
+			int key = 2 * (int)(generator() % (2 * n + 1));
+			reb.InsertNode(key);
+			reference.insert(key);
+		}
+		vector<int> missing;
+		for (int key = -1; key <= 4 * (int)n + 2; key++) missing.push_back(key);
+		if (!CheckFrozenOf("int", reb, reference, missing)) return false;
+	}
+	for (size_t n = 1000; n <= 100000; n *= 10)
+	{
+		RedBlackTree<int> reb;
+		set<int> reference;
+		FillRandom(reb, reference, n, INT32_MAX, generator());
+		vector<int> missing;
+		for (size_t i = 0; i < 100000; i++) missing.push_back((int)(generator() % INT32_MAX));
+		missing.push_back(INT32_MIN);
+		missing.push_back(INT32_MAX);
+		if (!CheckFrozenOf("int", reb, reference, missing)) return false;
+	}
+	RedBlackTree<string> strings;
+	set<string> reference;
+	vector<string> missing;
+	for (int i = 0; i < 5000; i++)
+	{
+		string key = "key-" + to_string(generator() % 10000) + "-beyond-small-string-buffer";
+		strings.InsertNode(key);
+		reference.insert(key);
+		missing.push_back("key-" + to_string(generator() % 10000) + "-beyond-small-string-buffer");
+	}
+	missing.push_back("");
+	return CheckFrozenOf("string", strings, reference, missing);
+}
+
+//AccessNode and AccessBatch of every SIMD level this processor has against std::set, with both ends of the type stored,
+//as the largest value is also the padding of the last node
+template <class Key> static bool CheckStaticBTreeOf(const char* name, uint64_t seed)
+{
+	mt19937_64 generator(seed);
+	static const SimdLevel Levels[] = { ScalarLevel, Sse42Level, Avx2Level };
+	for (size_t n = 0; n <= 100000; n = n < 200 ? n + 1 : 100 * n)
+	{
+		RedBlackTree<Key> reb;
+		set<Key> reference;
+		vector<Key> probes;
+		for (size_t i = 0; i < n + 50; i++)
+		{
+			//halves make the floating point keys fractions, integers just get every other key
+			Key key = (Key)(((long long)(generator() % (4 * n + 4)) - (long long)(2 * n)) / 2.0);
+			if (i < n)
+			{
+				reb.InsertNode(key);
+				reference.insert(key);
+			}
+			probes.push_back(key);
+		}
+		if (n % 3 == 0)
+		{
+			reb.InsertNode(numeric_limits<Key>::max());
+			reb.InsertNode(numeric_limits<Key>::lowest());
+			reference.insert(numeric_limits<Key>::max());
+			reference.insert(numeric_limits<Key>::lowest());
+		}
+		probes.push_back(numeric_limits<Key>::max());
+		probes.push_back(numeric_limits<Key>::lowest());
+		StaticBTree<Key> tree = reb.ExportBTree();
+		if (tree.Size() != reference.size()) return Fail(string(name) + " static tree size differs");
+		for (size_t l = 0; l < sizeof(Levels) / sizeof(Levels[0]); l++)
+		{
+			tree.SetSimdLevel(Levels[l]);
+			string level = string(name) + " level " + to_string(tree.GetSimdLevel()) + " with " + to_string(reference.size()) + " values";
+			vector<const Key*> batch(probes.size());
+			tree.AccessBatch(probes.data(), probes.size(), batch.data());
+			for (size_t i = 0; i < probes.size(); i++)
+			{
+				const Key* found = tree.AccessNode(probes[i]);
+				bool expected = reference.count(probes[i]) != 0;
+				if ((found != NULL) != expected || (found != NULL && *found != probes[i])) return Fail(level + ": AccessNode differs from std::set");
+				if (batch[i] != found) return Fail(level + ": AccessBatch differs from AccessNode");
+			}
+		}
+	}
+	return true;
+}
+static bool CheckStaticBTree()
+{
+	return CheckStaticBTreeOf<int32_t>("int32", 16) && CheckStaticBTreeOf<int64_t>("int64", 17)
+		&& CheckStaticBTreeOf<float>("float", 18) && CheckStaticBTreeOf<double>("double", 19);
+}
+
+//AccessBatch against one AccessNode per key, on trees of many sizes, one with repairs pending and with heterogeneous keys
+template <class Tree> static bool CheckAccessBatchOf(const char* name, bool relaxed)
+{
+	mt19937_64 generator(17);
+	for (size_t n = 0; n <= 100000; n = n < 100 ? n + 1 : 10 * n)
+	{
+		Tree reb;
+		reb.SetRelaxedBalance(relaxed);
+		set<int> reference;
+		FillRandom(reb, reference, n, (int)(2 * n + 1), generator());
+		//the batch sizes run over and under whole groups
+		vector<int> keys(generator() % 100 + n);
+		for (size_t i = 0; i < keys.size(); i++) keys[i] = (int)(generator() % (2 * n + 3)) - 1;
+		vector<typename Tree::Node*> out(keys.size());
+		reb.AccessBatch(keys.data(), keys.size(), out.data());
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			if (out[i] != reb.AccessNode(keys[i])) return Fail(string(name) + " AccessBatch over " + to_string(n) + " values differs from AccessNode");
+		}
+	}
+	return true;
+}
+static bool CheckAccessBatch()
+{
+	if (!CheckAccessBatchOf<RedBlackTree<int> >("plain", false) || !CheckAccessBatchOf<RankedTree>("OrderStatistics", false)
+		|| !CheckAccessBatchOf<RedBlackTree<int> >("relaxed", true)) return false;
+	typedef RedBlackTree<string, less<void> > NameTree;
+	NameTree strings;
+	vector<const char*> keys;
+	static const char* Words[] = { "alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta", "iota", "kappa" };
+	for (size_t i = 0; i < 1000; i++)
+	{
+		if (i % 3 == 0) strings.InsertNode(Words[i % 10] + to_string(i));
+		keys.push_back(Words[i % 10]);
+	}
+	vector<string> names;
+	for (size_t i = 0; i < 1000; i++) names.push_back(Words[i % 10] + to_string(i));
+	for (size_t i = 0; i < 1000; i++) keys.push_back(names[i].c_str());
+	vector<NameTree::Node*> out(keys.size());
+	strings.AccessBatch(keys.data(), keys.size(), out.data());
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		if (out[i] != strings.AccessNode(keys[i])) return Fail("heterogeneous AccessBatch differs from AccessNode");
+	}
+	return true;
+}
+
+//copies the first size bytes of a file into another one, or garbage of that size with garbage set
+static bool WriteCopy(const char* from, const char* to, size_t size, bool garbage)
+{
+	vector<char> bytes(size);
+	FILE* file = fopen(from, "rb");
+	if (file == NULL) return false;
+	size_t read = fread(bytes.data(), 1, size, file);
+	fclose(file);
+	if (garbage) for (size_t i = 0; i < size; i++) bytes[i] = (char)(i * 7 + 3);
+	file = fopen(to, "wb");
+	if (file == NULL) return false;
+	bool written = fwrite(bytes.data(), 1, read, file) == read;
+	return fclose(file) == 0 && written;
+}
+
+//images of every page fill saved, mapped and searched against std::set, then saved over while still mapped
+//files cut short, overwritten with garbage or of another value type are refused
+static bool CheckMapped()
+{
+	const char* path = "TreeCheckZone.image";
+	const char* broken = "TreeCheckZone.broken";
+	typedef MappedRedBlackTree<int> Image;
+	mt19937_64 generator(18);
+	static const size_t Sizes[] = { 0, 1, 2, 1023, 1024, 1025, 4096, 100000 };
+	for (size_t s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++)
+	{
+		RedBlackTree<int> reb;
+		set<int> reference;
+		while (reference.size() < Sizes[s])
+		{
+			int key = (int)(generator() % (4 * Sizes[s])) - (int)Sizes[s];
+			reb.InsertNode(key);
+			reference.insert(key);
+		}
+		string size = to_string(Sizes[s]);
+		if (!Image::Save(reb, path)) return Fail("could not save an image of " + size + " values");
+		Image image;
+		if (!image.Open(path) || image.Size() != reference.size()) return Fail("image of " + size + " values did not open");
+		if (!SameContents(image.begin(), image.end(), reference)) return Fail("image of " + size + " values differs from std::set");
+		vector<int> sorted(reference.begin(), reference.end());
+		for (int key = -(int)Sizes[s] - 1; key <= 3 * (int)Sizes[s] + 1; key++)
+		{
+			vector<int>::iterator lower = std::lower_bound(sorted.begin(), sorted.end(), key), upper = std::upper_bound(sorted.begin(), sorted.end(), key);
+			if (image.lower_bound(key) != image.begin() + (lower - sorted.begin())) return Fail("image lower_bound differs from std::lower_bound");
+			if (image.upper_bound(key) != image.begin() + (upper - sorted.begin())) return Fail("image upper_bound differs from std::upper_bound");
+			if ((image.AccessNode(key) != NULL) != (lower != upper)) return Fail("image AccessNode differs from std::set");
+		}
+		RedBlackTree<int> thawed;
+		image.Thaw(thawed);
+		if (!thawed.Validate().IsValid() || !SameContents(thawed.begin(), thawed.end(), reference)) return Fail("thawed image differs from std::set");
+		//a new image replaces the file, the mapped one stays whole
+		RedBlackTree<int> other;
+		other.InsertNode(-5);
+		if (!Image::Save(other, path)) return Fail("could not save over a mapped image");
+		if (!SameContents(image.begin(), image.end(), reference)) return Fail("saving over a mapped image changed it");
+		Image replaced;
+		if (!replaced.Open(path) || replaced.Size() != 1 || *replaced.begin() != -5) return Fail("the replacing image did not open");
+		if (fopen((string(path) + ".tmp").c_str(), "rb") != NULL) return Fail("save left its temporary file");
+		if (!Image::Save(reb, path)) return Fail("could not save an image of " + size + " values again");
+		//every cut of the file is refused
+		size_t cuts[] = { 0, 8, sizeof(MappedImageHeader) - 1, sizeof(MappedImageHeader), 4096, 4096 + 4 * Sizes[s] };
+		for (size_t c = 0; c < sizeof(cuts) / sizeof(cuts[0]); c++)
+		{
+			Image cut;
+			if (Sizes[s] > 0 && WriteCopy(path, broken, cuts[c], false) && cut.Open(broken)) return Fail("image of " + size + " values cut to " + to_string(cuts[c]) + " bytes opened");
+		}
+		Image garbage;
+		if (WriteCopy(path, broken, 8192, true) && garbage.Open(broken)) return Fail("garbage opened as an image");
+		MappedRedBlackTree<double> wrongType;
+		if (wrongType.Open(path)) return Fail("int image opened as a double one");
+	}
+	//an interrupted save leaves a header without magic
+	FILE* file = fopen(broken, "wb");
+	MappedImageHeader header;
+	memset(&header, 0, sizeof(header));
+	header.version = MappedImageHeader::CurrentVersion;
+	header.valueSize = sizeof(int);
+	header.pageValues = 1024;
+	header.valuesOffset = 4096;
+	bool written = file != NULL && fwrite(&header, sizeof(header), 1, file) == 1;
+	if (file != NULL) fclose(file);
+	Image interrupted;
+	if (!written || interrupted.Open(broken)) return Fail("header of an interrupted save opened as an empty image");
+	Image missing;
+	RedBlackTree<int> empty;
+	if (missing.Open("TreeCheckZone.missing") || Image::Save(empty, "TreeCheckZone.missing/image")) return Fail("missing file or directory accepted");
+	remove(path);
+	remove(broken);
+	return true;
+}
+
+static size_t FileSize(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return 0;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	return size < 0 ? 0 : (size_t)size;
+}
+
+//written and loaded back into a tree that had other values, then every cut of the stream is refused
+template <class Value> static bool CheckStreamOf(const char* name, const set<Value>& reference, const Value& other, const char* path, bool everyCut)
+{
+	const char* cut = "TreeCheckZone.cut";
+	RedBlackTree<Value> reb(reference.begin(), reference.end());
+	if (!TreeStreamWriter<Value>().Write(reb, path)) return Fail(string(name) + " stream could not be written");
+	RedBlackTree<Value> loaded;
+	loaded.InsertNode(other);
+	if (!TreeStreamReader<Value>::Load(loaded, path)) return Fail(string(name) + " stream of " + to_string(reference.size()) + " values did not load");
+	if (!loaded.Validate().IsValid() || !SameContents(loaded.begin(), loaded.end(), reference)) return Fail(string(name) + " stream of " + to_string(reference.size()) + " values differs after loading");
+	//the nodes of the loaded chunks are recycled by later changes
+	set<Value> changed;
+	size_t position = 0;
+	for (typename set<Value>::const_iterator it = reference.begin(); it != reference.end(); ++it, position++)
+	{
+		if (position % 2 == 0) loaded.DeleteNode(*it);
+		else changed.insert(*it);
+	}
+	loaded.InsertNode(other);
+	changed.insert(other);
+	if (!loaded.Validate().IsValid() || !SameContents(loaded.begin(), loaded.end(), changed)) return Fail(string(name) + " changes after loading differ from std::set");
+	size_t size = FileSize(path);
+	vector<size_t> lengths;
+	for (size_t length = 0; length < size; length += everyCut ? 1 : size / 97 + 1) lengths.push_back(length);
+	//this one only loses the end of the stream
+	if (size > 0) lengths.push_back(size - 1);
+	for (size_t i = 0; i < lengths.size(); i++)
+	{
+		if (WriteCopy(path, cut, lengths[i], false) && TreeStreamReader<Value>::Load(loaded, cut)) return Fail(string(name) + " stream cut to " + to_string(lengths[i]) + " of " + to_string(size) + " bytes loaded");
+	}
+	remove(cut);
+	return true;
+}
+
+//streams of integers, front coded strings and plain values round trip; a checkpoint written step by step while the tree
+//changes comes out exact once its write ahead log is replayed, and the replay stops at the first torn or garbled record
+static bool CheckStream()
+{
+	const char* stream = "TreeCheckZone.stream";
+	const char* log = "TreeCheckZone.log";
+	const char* broken = "TreeCheckZone.broken";
+	mt19937_64 generator(19);
+	static const size_t Sizes[] = { 0, 1, 2, 4095, 4096, 4097, 100000 };
+	for (size_t s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++)
+	{
+		set<int> integers;
+		set<string> strings;
+		set<double> doubles;
+		while (integers.size() < Sizes[s]) integers.insert((int)(generator() % (8 * Sizes[s])) - (int)(4 * Sizes[s]));
+		if (Sizes[s] > 2)
+		{
+			integers.insert(INT32_MIN);
+			integers.insert(INT32_MAX);
+			strings.insert("");
+		}
+		while (strings.size() < Sizes[s]) strings.insert("key-" + to_string(generator() % (4 * Sizes[s])) + (generator() % 2 == 0 ? "-beyond-small-string-buffer" : ""));
+		while (doubles.size() < Sizes[s]) doubles.insert((double)(generator() % 1000000) / 7.0);
+		bool everyCut = Sizes[s] <= 2;
+		if (!CheckStreamOf("int", integers, 42, stream, everyCut) || !CheckStreamOf("string", strings, string("other"), stream, everyCut)
+			|| !CheckStreamOf("double", doubles, -1.0, stream, everyCut)) return false;
+	}
+	RedBlackTree<string> wrongType;
+	if (TreeStreamReader<string>::Load(wrongType, stream)) return Fail("double stream loaded as a string one");
+	RedBlackTree<int> missing;
+	if (TreeStreamReader<int>::Load(missing, "TreeCheckZone.missing")) return Fail("missing stream loaded");
+
+	//a checkpoint of a tree that keeps changing between the steps
+	RedBlackTree<int> reb;
+	set<int> reference;
+	FillRandom(reb, reference, 20000, 40000, generator());
+	remove(log);
+	TreeWriteAheadLog<int> wal;
+	TreeStreamWriter<int> writer;
+	if (!wal.Open(log) || !writer.Open(stream)) return Fail("checkpoint files could not be opened");
+	size_t logged = 0;
+	do
+	{
+		if (!writer.Step(reb, 100)) return Fail("checkpoint step failed");
+		for (int i = 0; i < 20; i++, logged++)
+		{
+			int key = (int)(generator() % 40000);
+			if (generator() % 2 == 0)
+			{
+				wal.InsertNode(reb, key);
+				reference.insert(key);
+			}
+			else
+			{
+				wal.DeleteNode(reb, key);
+				reference.erase(key);
+			}
+		}
+	} while (!writer.IsDone());
+	wal.Close();
+	if (!writer.Finish()) return Fail("checkpoint could not be finished");
+	RedBlackTree<int> recovered;
+	if (!TreeStreamReader<int>::Load(recovered, stream)) return Fail("fuzzy checkpoint did not load");
+	if (TreeWriteAheadLog<int>::Replay(recovered, log) != logged) return Fail("replay skipped records");
+	if (!recovered.Validate().IsValid() || !SameContents(recovered.begin(), recovered.end(), reference)) return Fail("checkpoint and log differ from std::set after recovery");
+
+	//a torn last record and a garbled middle one end the replay before them
+	size_t size = FileSize(log);
+	RedBlackTree<int> ignored;
+	if (!WriteCopy(log, broken, size - 2, false) || TreeWriteAheadLog<int>::Replay(ignored, broken) != logged - 1) return Fail("replay went past a torn record");
+	if (!WriteCopy(log, broken, size, false)) return Fail("log could not be copied");
+	wal.Open(broken);
+	for (int key = 0; key < 10; key++) wal.LogInsert(key);
+	wal.Close();
+	//the first payload byte of the records appended to the copy
+	FILE* file = fopen(broken, "r+b");
+	bool garbled = file != NULL && fseek(file, (long)size + 2, SEEK_SET) == 0 && fputc(0x55, file) != EOF;
+	if (file != NULL) fclose(file);
+	if (!garbled || TreeWriteAheadLog<int>::Replay(ignored, broken) != logged) return Fail("replay went past a garbled record");
+	remove(stream);
+	remove(log);
+	remove(broken);
+	return true;
+}
+
+struct Check
+{
+	const char* name;
+	bool (*run)();
+};
+static const Check Checks[] =
+{
+	{ "RedBlackMap", CheckMap },
+	{ "Iterators", CheckIterators },
+	{ "OrderStatistics", CheckOrderStatistics },
+	{ "MonoidAugment", CheckMonoidAugment },
+	{ "BuildFromSorted", CheckBuildFromSorted },
+	{ "Batch", CheckBatch },
+	{ "SetOperations", CheckSetOperations },
+	{ "Concurrent", CheckConcurrent },
+	{ "Persistent", CheckPersistent },
+	{ "Frozen", CheckFrozen },
+	{ "StaticBTree", CheckStaticBTree },
+	{ "AccessBatch", CheckAccessBatch },
+	{ "Mapped", CheckMapped },
+	{ "Stream", CheckStream },
+};
+
+int main(int argc, char **argv)
+{
+	cout << "Tree Check Zone \n-----------------\n\n";
+	size_t failed = 0, run = 0;
+	for (size_t i = 0; i < sizeof(Checks) / sizeof(Checks[0]); i++)
+	{
+		if (argc > 1 && strcmp(argv[1], Checks[i].name) != 0) continue;
+		printf("%s\n", Checks[i].name);
+		bool passed = Checks[i].run();
+		printf("   %s\n", passed ? "passed" : "FAILED");
+		if (!passed) failed++;
+		run++;
+	}
+	if (run == 0)
+	{
+		printf("no check named %s\n", argv[1]);
+		return 1;
+	}
+	printf("\n%zu of %zu checks passed.\n", run - failed, run);
+	return failed == 0 ? 0 : 1;
+}
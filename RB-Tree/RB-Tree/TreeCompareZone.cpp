@@ -0,0 +1,542 @@
+/* TreeCompareZone.cpp :
+this short code compares the red black tree with std::set and a reference B-tree
+on sequential, random, zipfian and adversarial keys under insert, lookup and delete heavy mixes
+run with a name filter as argument to run only the matching benchmarks (e.g. "RedBlackTree/zipfian"),
+and with "full" to go from 1K up to 100M keys instead of 1M
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <iostream>
+#include <vector>
+#include <set>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include "RedBlackTree.h"
+#include "ZoneAllocations.h"
+
+using namespace std;
+
+//textbook B-tree (Cormen et al.) with nodes of Degree - 1 to 2 * Degree - 1 keys, splitting and merging on the way down
+//only here as a reference point for the benchmark, it is not part of the library
+template <class T, class Compare = less<T>, int Degree = 16> class ReferenceBTree
+{
+private:
+	static const int MaxKeys = 2 * Degree - 1;
+	struct Node
+	{
+		int count;
+		bool leaf;
+		T keys[MaxKeys];
+		Node* children[MaxKeys + 1];
+	};
+
+	Node* root;
+	Compare compare;
+
+	ReferenceBTree(const ReferenceBTree&) = delete;
+	ReferenceBTree& operator=(const ReferenceBTree&) = delete;
+
+	static Node* NewNode(bool leaf)
+	{
+		Node* node = new Node;
+		node->count = 0;
+		node->leaf = leaf;
+		return node;
+	}
+	static void Destroy(Node* node)
+	{
+		if (!node->leaf) for (int i = 0; i <= node->count; i++) Destroy(node->children[i]);
+		delete node;
+	}
+	//position of the first key not less than the given one
+	int Position(const Node* node, const T& key) const
+	{
+		return (int)(lower_bound(node->keys, node->keys + node->count, key, this->compare) - node->keys);
+	}
+	//the full child i moves its middle key up into the parent and gives its upper half to a new right sibling
+	void SplitChild(Node* parent, int i)
+	{
+		Node* full = parent->children[i];
+		Node* right = NewNode(full->leaf);
+		right->count = Degree - 1;
+		for (int j = 0; j < Degree - 1; j++) right->keys[j] = full->keys[j + Degree];
+		if (!full->leaf) for (int j = 0; j < Degree; j++) right->children[j] = full->children[j + Degree];
+		full->count = Degree - 1;
+		for (int j = parent->count; j > i; j--) parent->children[j + 1] = parent->children[j];
+		parent->children[i + 1] = right;
+		for (int j = parent->count - 1; j >= i; j--) parent->keys[j + 1] = parent->keys[j];
+		parent->keys[i] = full->keys[Degree - 1];
+		parent->count++;
+	}
+	//children i and i + 1, both at the minimum, become one full node around key i
+	void Merge(Node* node, int i)
+	{
+		Node* left = node->children[i];
+		Node* right = node->children[i + 1];
+		left->keys[Degree - 1] = node->keys[i];
+		for (int j = 0; j < right->count; j++) left->keys[Degree + j] = right->keys[j];
+		if (!left->leaf) for (int j = 0; j <= right->count; j++) left->children[Degree + j] = right->children[j];
+		left->count += right->count + 1;
+		for (int j = i; j < node->count - 1; j++) node->keys[j] = node->keys[j + 1];
+		for (int j = i + 1; j < node->count; j++) node->children[j] = node->children[j + 1];
+		node->count--;
+		delete right;
+	}
+	//child i takes a key through the parent from its left or right sibling
+	void BorrowLeft(Node* node, int i)
+	{
+		Node* child = node->children[i];
+		Node* sibling = node->children[i - 1];
+		for (int j = child->count - 1; j >= 0; j--) child->keys[j + 1] = child->keys[j];
+		if (!child->leaf) for (int j = child->count; j >= 0; j--) child->children[j + 1] = child->children[j];
+		child->keys[0] = node->keys[i - 1];
+		if (!child->leaf) child->children[0] = sibling->children[sibling->count];
+		node->keys[i - 1] = sibling->keys[sibling->count - 1];
+		sibling->count--;
+		child->count++;
+	}
+	void BorrowRight(Node* node, int i)
+	{
+		Node* child = node->children[i];
+		Node* sibling = node->children[i + 1];
+		child->keys[child->count] = node->keys[i];
+		if (!child->leaf) child->children[child->count + 1] = sibling->children[0];
+		node->keys[i] = sibling->keys[0];
+		for (int j = 0; j < sibling->count - 1; j++) sibling->keys[j] = sibling->keys[j + 1];
+		if (!sibling->leaf) for (int j = 0; j < sibling->count; j++) sibling->children[j] = sibling->children[j + 1];
+		sibling->count--;
+		child->count++;
+	}
+public:
+	ReferenceBTree() : root(NewNode(true))
+	{
+	}
+	~ReferenceBTree()
+	{
+		Destroy(this->root);
+	}
+
+	bool Contains(const T& key) const
+	{
+		const Node* node = this->root;
+		while (true)
+		{
+			int i = this->Position(node, key);
+			if (i < node->count && !this->compare(key, node->keys[i])) return true;
+			if (node->leaf) return false;
+			node = node->children[i];
+		}
+	}
+	//false if the key was already there
+	bool Insert(const T& key)
+	{
+		if (this->root->count == MaxKeys)
+		{
+			Node* top = NewNode(false);
+			top->children[0] = this->root;
+			this->root = top;
+			this->SplitChild(top, 0);
+		}
+		Node* node = this->root;
+		while (true)
+		{
+			int i = this->Position(node, key);
+			if (i < node->count && !this->compare(key, node->keys[i])) return false;
+			if (node->leaf)
+			{
+				for (int j = node->count - 1; j >= i; j--) node->keys[j + 1] = node->keys[j];
+				node->keys[i] = key;
+				node->count++;
+				return true;
+			}
+			//never descend into a full node, so a split below has room for its middle key
+			if (node->children[i]->count == MaxKeys)
+			{
+				this->SplitChild(node, i);
+				if (this->compare(node->keys[i], key)) i++;
+				else if (!this->compare(key, node->keys[i])) return false;
+			}
+			node = node->children[i];
+		}
+	}
+	//false if the key was not there
+	bool Erase(const T& key)
+	{
+		T target = key;
+		bool erased = false;
+		Node* node = this->root;
+		while (true)
+		{
+			int i = this->Position(node, target);
+			bool found = i < node->count && !this->compare(target, node->keys[i]);
+			if (node->leaf)
+			{
+				if (found)
+				{
+					for (int j = i; j < node->count - 1; j++) node->keys[j] = node->keys[j + 1];
+					node->count--;
+					erased = true;
+				}
+				break;
+			}
+			//never descend into a node at the minimum, so a removal below cannot underflow
+			if (found)
+			{
+				Node* left = node->children[i];
+				Node* right = node->children[i + 1];
+				if (left->count >= Degree)
+				{
+					//replaced by its predecessor, which is removed from the left subtree instead
+					const Node* last = left;
+					while (!last->leaf) last = last->children[last->count];
+					target = last->keys[last->count - 1];
+					node->keys[i] = target;
+					node = left;
+				}
+				else if (right->count >= Degree)
+				{
+					const Node* first = right;
+					while (!first->leaf) first = first->children[0];
+					target = first->keys[0];
+					node->keys[i] = target;
+					node = right;
+				}
+				else
+				{
+					this->Merge(node, i);
+					node = left;
+				}
+				continue;
+			}
+			if (node->children[i]->count == Degree - 1)
+			{
+				if (i > 0 && node->children[i - 1]->count >= Degree) this->BorrowLeft(node, i);
+				else if (i < node->count && node->children[i + 1]->count >= Degree) this->BorrowRight(node, i);
+				else if (i < node->count) this->Merge(node, i);
+				else this->Merge(node, --i);
+			}
+			node = node->children[i];
+		}
+		//a merge of the only two children of the root leaves it empty
+		if (this->root->count == 0 && !this->root->leaf)
+		{
+			Node* empty = this->root;
+			this->root = empty->children[0];
+			delete empty;
+		}
+		return erased;
+	}
+};
+
+//the compared containers behind one interface
+struct RedBlackTreeAdapter
+{
+	static const char* Name()
+	{
+		return "RedBlackTree";
+	}
+	RedBlackTree<int> tree;
+
+	void Insert(int key)
+	{
+		this->tree.InsertNode(key);
+	}
+	bool Contains(int key)
+	{
+		return this->tree.AccessNode(key) != NULL;
+	}
+	void Erase(int key)
+	{
+		this->tree.DeleteNode(key);
+	}
+};
+struct StdSetAdapter
+{
+	static const char* Name()
+	{
+		return "std::set";
+	}
+	set<int> tree;
+
+	void Insert(int key)
+	{
+		this->tree.insert(key);
+	}
+	bool Contains(int key)
+	{
+		return this->tree.find(key) != this->tree.end();
+	}
+	void Erase(int key)
+	{
+		this->tree.erase(key);
+	}
+};
+struct ReferenceBTreeAdapter
+{
+	static const char* Name()
+	{
+		return "ReferenceBTree";
+	}
+	ReferenceBTree<int> tree;
+
+	void Insert(int key)
+	{
+		this->tree.Insert(key);
+	}
+	bool Contains(int key)
+	{
+		return this->tree.Contains(key);
+	}
+	void Erase(int key)
+	{
+		this->tree.Erase(key);
+	}
+};
+
+//ranks 0..n-1 drawn with probability proportional to 1 / (rank + 1)^theta (Gray et al., as in YCSB)
+class ZipfianGenerator
+{
+private:
+	size_t n;
+	double theta, alpha, zetan, eta;
+
+	static double Zeta(size_t n, double theta)
+	{
+		double sum = 0;
+		for (size_t i = 1; i <= n; i++) sum += 1 / pow((double)i, theta);
+		return sum;
+	}
+public:
+	ZipfianGenerator(size_t n, double theta = 0.99) : n(n), theta(theta)
+	{
+		this->alpha = 1 / (1 - theta);
+		this->zetan = Zeta(n, theta);
+		this->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - Zeta(2, theta) / this->zetan);
+	}
+	template <class Generator> size_t Next(Generator& generator)
+	{
+		double u = uniform_real_distribution<double>(0, 1)(generator);
+		double uz = u * this->zetan;
+		if (uz < 1) return 0;
+		if (uz < 1 + pow(0.5, this->theta)) return 1;
+		size_t rank = (size_t)(this->n * pow(this->eta * u - this->eta + 1, this->alpha));
+		return rank < this->n ? rank : this->n - 1;
+	}
+};
+
+enum Distribution { Sequential, Uniform, Zipfian, Adversarial };
+static const char* const DistributionNames[] = { "sequential", "random", "zipfian", "adversarial" };
+
+//percentages of a mix of operations run on a tree of n keys
+struct Mix
+{
+	const char* name;
+	int insert, lookup, erase;
+};
+static const Mix Mixes[] = { { "insert-heavy", 70, 20, 10 }, { "lookup-heavy", 5, 90, 5 }, { "delete-heavy", 10, 20, 70 } };
+
+struct Operation
+{
+	char kind;
+	int key;
+};
+
+//the keys a tree of n is built from and the keys the operations of each mix use, generated before any timing
+//sequential: ascending keys, inserts append at the top and deletes take the oldest, like a queue
+//random: even keys in random order, operations on uniform keys of twice the range, so half of the lookups miss
+//zipfian: the random tree, operations on a few hot keys and their odd neighbours
+//adversarial: keys inserted from both ends inwards, operations on the current minimum and maximum,
+//so every insert lands on a spine and rebalances and every lookup walks a whole spine down to its leaf,
+//which is a short path of a red black tree rather than its deepest one
+struct Workload
+{
+	vector<int> build;
+	vector<Operation> operations[sizeof(Mixes) / sizeof(Mixes[0])];
+
+	Workload(Distribution distribution, size_t n, size_t count)
+	{
+		mt19937_64 generator(n + distribution);
+		this->build.resize(n);
+		if (distribution == Adversarial)
+		{
+			for (size_t i = 0; i < n; i++) this->build[i] = (int)(i % 2 == 0 ? i / 2 : n - 1 - i / 2);
+		}
+		else if (distribution == Sequential)
+		{
+			for (size_t i = 0; i < n; i++) this->build[i] = (int)i;
+		}
+		else
+		{
+			for (size_t i = 0; i < n; i++) this->build[i] = (int)(2 * i);
+			shuffle(this->build.begin(), this->build.end(), generator);
+		}
+		//its zeta sum takes O(n), the other distributions never draw from it
+		ZipfianGenerator zipfian(distribution == Zipfian ? n : 1);
+		for (size_t m = 0; m < sizeof(Mixes) / sizeof(Mixes[0]); m++)
+		{
+			vector<Operation>& operations = this->operations[m];
+			operations.resize(count);
+			long long low = 0, high = (long long)n - 1, lookup = 0;
+			for (size_t i = 0; i < count; i++)
+			{
+				int roll = (int)(generator() % 100);
+				char kind = roll < Mixes[m].insert ? 'I' : (roll < Mixes[m].insert + Mixes[m].lookup ? 'L' : 'D');
+				long long key = 0;
+				switch (distribution)
+				{
+				case Sequential:
+					if (kind == 'I') key = ++high;
+					else if (kind == 'D') key = low <= high ? low++ : low;
+					else key = low + (lookup++ % max(high - low + 1, 1LL));
+					break;
+				case Uniform:
+					key = (long long)(generator() % (2 * n));
+					break;
+				case Zipfian:
+					//the build order is random, so its first keys are as good a hot set as any
+					key = (long long)this->build[zipfian.Next(generator)] + (kind == 'I' ? 1 : 0);
+					break;
+				case Adversarial:
+					if (kind == 'I') key = i % 2 == 0 ? --low : ++high;
+					else if (kind == 'D') key = low > high ? low : (i % 2 == 0 ? low++ : high--);
+					else key = i % 2 == 0 ? low : high;
+					break;
+				}
+				operations[i].kind = kind;
+				operations[i].key = (int)key;
+			}
+		}
+	}
+};
+
+static double NsPerOp(chrono::steady_clock::time_point start, size_t ops)
+{
+	chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+	return elapsed.count() / ops;
+}
+
+//the hits of the lookups are printed so they cannot be optimized away
+static void Report(const string& name, double ns, double allocations, double bytesPerKey, size_t peakBytes, long long found)
+{
+	printf("%-44s %10.1f %11.2f ", name.c_str(), ns, allocations);
+	if (bytesPerKey >= 0) printf("%12.1f", bytesPerKey);
+	else printf("%12s", "");
+	printf(" %14.1f", peakBytes / 1024.0);
+	if (found >= 0) printf(" %12lld", found);
+	printf("\n");
+}
+
+static bool Matches(const char* filter, const string& name)
+{
+	return filter == NULL || name.find(filter) != string::npos;
+}
+//whether the workload needs to be generated at all
+static bool Selected(const char* filter, const char* distribution, size_t n)
+{
+	const char* containers[] = { RedBlackTreeAdapter::Name(), StdSetAdapter::Name(), ReferenceBTreeAdapter::Name() };
+	for (size_t c = 0; c < 3; c++)
+	{
+		string prefix = string(containers[c]) + "/" + distribution + "/";
+		if (Matches(filter, prefix + "build/" + to_string(n))) return true;
+		for (size_t m = 0; m < sizeof(Mixes) / sizeof(Mixes[0]); m++) if (Matches(filter, prefix + Mixes[m].name + "/" + to_string(n))) return true;
+	}
+	return false;
+}
+
+//small trees are built and run again until a million operations are timed, the fresh trees are not timed
+//the peak heap is the most any one container held, the workload allocated before it is not counted
+template <class Container> static void Run(const Workload& workload, const char* distribution, size_t n, const char* filter)
+{
+	string prefix = string(Container::Name()) + "/" + distribution + "/";
+	string suffix = "/" + to_string(n);
+	size_t count = workload.operations[0].size();
+	size_t repeats = n < 1000000 ? 1000000 / n : 1;
+
+	string name = prefix + "build" + suffix;
+	if (Matches(filter, name))
+	{
+		double ns = 0;
+		size_t allocations = 0, bytes = 0, size = 0, peakBytes = 0;
+		for (size_t r = 0; r < repeats; r++)
+		{
+			size_t startHeap = ResetHeapPeak();
+			Container *container = new Container();
+			size_t startCount = allocationCount, startBytes = allocationBytes;
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			for (size_t i = 0; i < n; i++) container->Insert(workload.build[i]);
+			ns += NsPerOp(start, n);
+			allocations += allocationCount - startCount;
+			bytes += allocationBytes - startBytes;
+			size += n;
+			peakBytes = max(peakBytes, heapPeakBytes - startHeap);
+			delete container;
+		}
+		Report(name, ns / repeats, (double)allocations / size, (double)bytes / size, peakBytes, -1);
+	}
+
+	for (size_t m = 0; m < sizeof(Mixes) / sizeof(Mixes[0]); m++)
+	{
+		name = prefix + Mixes[m].name + suffix;
+		if (!Matches(filter, name)) continue;
+		const vector<Operation>& operations = workload.operations[m];
+		double ns = 0;
+		size_t allocations = 0, found = 0, peakBytes = 0;
+		for (size_t r = 0; r < repeats; r++)
+		{
+			size_t startHeap = ResetHeapPeak();
+			Container *container = new Container();
+			for (size_t i = 0; i < n; i++) container->Insert(workload.build[i]);
+			size_t startCount = allocationCount;
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			for (size_t i = 0; i < count; i++)
+			{
+				const Operation& operation = operations[i];
+				if (operation.kind == 'I') container->Insert(operation.key);
+				else if (operation.kind == 'D') container->Erase(operation.key);
+				else if (container->Contains(operation.key)) found++;
+			}
+			ns += NsPerOp(start, count);
+			allocations += allocationCount - startCount;
+			peakBytes = max(peakBytes, heapPeakBytes - startHeap);
+			delete container;
+		}
+		Report(name, ns / repeats, (double)allocations / (repeats * count), -1, peakBytes, (long long)(found / repeats));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	cout << "Tree Compare Zone \n-----------------\n\n";
+	bool full = false;
+	const char* filter = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "full") == 0) full = true;
+		else filter = argv[i];
+	}
+	size_t largest = full ? 100000000 : 1000000;
+	printf("%-44s %10s %11s %12s %14s %12s\n", "benchmark", "ns/op", "allocs/op", "heap B/key", "peak heap KiB", "found");
+	for (size_t n = 1000; n <= largest; n *= 10)
+	{
+		//a million operations per mix at most, the tree does not drift far from n
+		size_t count = min(n, (size_t)1000000);
+		for (int d = Sequential; d <= Adversarial; d++)
+		{
+			const char* distribution = DistributionNames[d];
+			if (!Selected(filter, distribution, n)) continue;
+			Workload workload((Distribution)d, n, count);
+			Run<RedBlackTreeAdapter>(workload, distribution, n, filter);
+			Run<StdSetAdapter>(workload, distribution, n, filter);
+			Run<ReferenceBTreeAdapter>(workload, distribution, n, filter);
+		}
+		cout << "\n";
+	}
+	return 0;
+}
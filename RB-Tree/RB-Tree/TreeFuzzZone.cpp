@@ -0,0 +1,269 @@
+/* TreeFuzzZone.cpp :
+this short code replays long random sequences of InsertNode and DeleteNode, and of their top-down variants, against std::set
+with relaxed balance switched on and off along the way and Rebalance called on pending violations,
+mixed with batches, set operations, splits and joins, on a tree that keeps subtree sizes and sums
+and validates the whole tree along the way, with Rank, Select and Aggregate, so the special cases of deletion can be changed safely
+run with the number of rounds and a seed as arguments, a failing round prints how to replay it alone
+built with RB_TREE_FUZZER and -fsanitize=fuzzer it is a libFuzzer target instead, decoding the same operations
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+#include <vector>
+#include <set>
+#include <random>
+#include <string>
+#include <algorithm>
+#include "RedBlackTree.h"
+
+using namespace std;
+
+//every operation takes three bytes: what to do and a 16 bit key
+//the operation byte also picks the key range, so the same input builds dense small trees and sparse large ones,
+//and whether insertion and deletion run bottom-up or top-down, so both kinds work on the trees the other left
+//its top bits all set switch relaxed balance, one less runs a few steps of Rebalance after the operation
+//two less make it a batch of keys drawn from the key instead, three less a set operation with a tree of such keys,
+//or with the top-down bit a split at the key and a join of both halves
+static const size_t OperationBytes = 3;
+static const int KeyMasks[] = { 0xF, 0xFF, 0xFFF, 0xFFFF };
+enum OperationGroup
+{
+	SingleGroup,
+	SetGroup = 4,
+	BatchGroup = 5
+};
+
+typedef RedBlackTree<int, less<int>, allocator<int>, MonoidAugment<SumMonoid<int, long long>, OrderStatistics> > FuzzTree;
+
+//full comparison with the reference, O(n)
+template <class Tree> static bool SameContents(Tree& tree, const set<int>& reference)
+{
+	set<int>::const_iterator expected = reference.begin();
+	for (typename Tree::Iterator it = tree.begin(); it != tree.end(); ++it, ++expected)
+	{
+		if (expected == reference.end() || *it != *expected) return false;
+	}
+	return expected == reference.end();
+}
+
+//up to 64 keys of the same range as the key, all of them following from it
+static vector<int> BatchKeys(int key, int mask)
+{
+	vector<int> keys(1 + (key & 63));
+	uint32_t state = (uint32_t)key * 2654435761u + 1;
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		state = state * 1664525u + 1013904223u;
+		keys[i] = (int)(state >> 16) & mask;
+	}
+	return keys;
+}
+
+static string OperationName(char operation, bool topDown, int group)
+{
+	if (group == BatchGroup) return operation == 'I' ? "InsertBatch" : (operation == 'D' ? "DeleteBatch" : "AccessBatch");
+	if (group == SetGroup && topDown) return "Split and Join at";
+	if (group == SetGroup) return operation == 'I' ? "Union" : (operation == 'D' ? "Difference" : "Intersection");
+	string name = operation == 'I' ? "InsertNode" : (operation == 'D' ? "DeleteNode" : "AccessNode");
+	return topDown && operation != 'L' ? name + "TopDown" : name;
+}
+
+static bool Fail(size_t step, char operation, bool topDown, int group, int key, const string& problem)
+{
+	printf("step %zu, %s %d: %s\n", step, OperationName(operation, topDown, group).c_str(), key, problem.c_str());
+	return false;
+}
+
+//a batch against the reference: InsertBatch and DeleteBatch have to report how many values they changed
+static bool ReplayBatch(FuzzTree& tree, set<int>& reference, char operation, const vector<int>& keys)
+{
+	if (operation == 'I')
+	{
+		size_t before = reference.size();
+		reference.insert(keys.begin(), keys.end());
+		return tree.InsertBatch(keys.data(), keys.size()) == reference.size() - before;
+	}
+	if (operation == 'D')
+	{
+		size_t removed = 0;
+		for (size_t i = 0; i < keys.size(); i++) removed += reference.erase(keys[i]);
+		return tree.DeleteBatch(keys.data(), keys.size()) == removed;
+	}
+	vector<FuzzTree::Node*> nodes(keys.size());
+	tree.AccessBatch(keys.data(), keys.size(), nodes.data());
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		if ((nodes[i] != NULL) != (reference.count(keys[i]) > 0) || (nodes[i] != NULL && nodes[i]->GetValue() != keys[i])) return false;
+	}
+	return true;
+}
+
+//a set operation with a tree of the keys, or a split at the key with both halves checked and joined again
+static bool ReplaySetOperation(FuzzTree& tree, set<int>& reference, char operation, bool topDown, int key, const vector<int>& keys)
+{
+	if (topDown)
+	{
+		FuzzTree right;
+		tree.Split(key, right);
+		if (tree.Size() != (size_t)distance(reference.begin(), reference.lower_bound(key))) return false;
+		if (right.Size() != (size_t)distance(reference.lower_bound(key), reference.end())) return false;
+		tree.Join(tree, right);
+		return right.IsEmpty();
+	}
+	FuzzTree other;
+	other.InsertBatch(keys.data(), keys.size());
+	set<int> otherReference(keys.begin(), keys.end());
+	set<int> result;
+	if (operation == 'I')
+	{
+		set_union(reference.begin(), reference.end(), otherReference.begin(), otherReference.end(), inserter(result, result.end()));
+		tree.Union(other);
+	}
+	else if (operation == 'D')
+	{
+		set_difference(reference.begin(), reference.end(), otherReference.begin(), otherReference.end(), inserter(result, result.end()));
+		tree.Difference(other);
+	}
+	else
+	{
+		set_intersection(reference.begin(), reference.end(), otherReference.begin(), otherReference.end(), inserter(result, result.end()));
+		tree.Intersection(other);
+	}
+	reference.swap(result);
+	//union takes the nodes of the other tree, the others only read it
+	return operation == 'I' ? other.IsEmpty() : SameContents(other, otherReference);
+}
+
+//order statistics and sums at a few places picked by the key, against positions in the sorted reference
+static bool SameStatistics(FuzzTree& tree, const set<int>& reference, int key)
+{
+	vector<int> sorted(reference.begin(), reference.end());
+	if (tree.Size() != sorted.size()) return false;
+	size_t rank = (size_t)(lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin());
+	if (tree.Rank(key) != rank) return false;
+	size_t positions[] = { 0, sorted.size() / 2, sorted.size() - 1, (size_t)key % (sorted.size() + 1), rank };
+	for (size_t i = 0; i < sizeof(positions) / sizeof(positions[0]); i++)
+	{
+		FuzzTree::Node* node = tree.Select(positions[i]);
+		if (positions[i] >= sorted.size() ? node != NULL : (node == NULL || node->GetValue() != sorted[positions[i]])) return false;
+	}
+	long long sum = 0;
+	for (size_t i = rank; i < sorted.size() && sorted[i] < key + 256; i++) sum += sorted[i];
+	return tree.Aggregate(key, key + 256) == sum;
+}
+
+//the tree is validated after every operation while it is small, and every 256 operations once it has grown
+static bool Replay(const uint8_t* data, size_t size)
+{
+	FuzzTree tree;
+	set<int> reference;
+	size_t steps = size / OperationBytes;
+	for (size_t step = 0; step < steps; step++)
+	{
+		const uint8_t* bytes = data + step * OperationBytes;
+		int mask = KeyMasks[(bytes[0] >> 2) & 3];
+		int key = (bytes[1] | bytes[2] << 8) & mask;
+		char operation = (bytes[0] & 3) < 2 ? 'I' : ((bytes[0] & 3) == 2 ? 'D' : 'L');
+		bool topDown = (bytes[0] & 0x10) != 0;
+		int group = (bytes[0] >> 5) == BatchGroup || (bytes[0] >> 5) == SetGroup ? bytes[0] >> 5 : SingleGroup;
+		if (group == BatchGroup)
+		{
+			if (!ReplayBatch(tree, reference, operation, BatchKeys(key, mask))) return Fail(step, operation, topDown, group, key, "batch result differs from std::set");
+		}
+		else if (group == SetGroup)
+		{
+			if (!ReplaySetOperation(tree, reference, operation, topDown, key, BatchKeys(key, mask))) return Fail(step, operation, topDown, group, key, "result differs from std::set");
+		}
+		else if (operation == 'I')
+		{
+			if (topDown) tree.InsertNodeTopDown(key);
+			else tree.InsertNode(key);
+			reference.insert(key);
+		}
+		else if (operation == 'D')
+		{
+			if (topDown)
+			{
+				if (tree.DeleteNodeTopDown(key) != (reference.erase(key) > 0)) return Fail(step, operation, topDown, group, key, "deletion result differs from std::set");
+			}
+			else
+			{
+				tree.DeleteNode(key);
+				reference.erase(key);
+			}
+		}
+		else
+		{
+			FuzzTree::Node* node = tree.AccessNode(key);
+			if ((node != NULL) != (reference.count(key) > 0)) return Fail(step, operation, topDown, group, key, "lookup differs from std::set");
+			if (node != NULL && node->GetValue() != key) return Fail(step, operation, topDown, group, key, "lookup found another value");
+		}
+		if ((bytes[0] >> 5) == 7) tree.SetRelaxedBalance(!tree.IsRelaxedBalance());
+		else if ((bytes[0] >> 5) == 6) tree.Rebalance(bytes[2] & 15);
+		if (reference.size() > 256 && step % 256 != 0 && step + 1 != steps) continue;
+		RedBlackTreeReport report = tree.Validate();
+		if (!report.IsValid()) return Fail(step, operation, topDown, group, key, report.firstViolation);
+		if (!tree.IsRelaxedBalance() && tree.Rebalance(0) > 0) return Fail(step, operation, topDown, group, key, "violations pending without relaxed balance");
+		if (report.nodes != reference.size() || !SameContents(tree, reference)) return Fail(step, operation, topDown, group, key, "contents differ from std::set");
+		if (!SameStatistics(tree, reference, key)) return Fail(step, operation, topDown, group, key, "Rank, Select or Aggregate differs from std::set");
+	}
+	return true;
+}
+
+#if defined(RB_TREE_FUZZER)
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	if (!Replay(data, size)) abort();
+	return 0;
+}
+#else
+//the validator itself has to notice broken trees, or a passing run means nothing
+static bool ValidatorCatchesDamage()
+{
+	RedBlackTree<int> tree;
+	for (int i = 0; i < 100; i++) tree.InsertNode(i);
+	if (!tree.Validate().IsValid()) return false;
+	//a black node turned red breaks the black heights, its red children make red-red pairs as well
+	RedBlackTree<int>::Node* node = tree.AccessNode(50);
+	node->Recolor();
+	RedBlackTreeReport report = tree.Validate();
+	node->Recolor();
+	if (report.IsValid() || report.nodes != 100) return false;
+	cout << "damaged tree reported: " << report.firstViolation << "\n";
+	return tree.Validate().IsValid();
+}
+
+int main(int argc, char **argv)
+{
+	cout << "Tree Fuzz Zone \n-----------------\n\n";
+	size_t rounds = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 1000;
+	uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 10) : random_device()();
+	if (!ValidatorCatchesDamage())
+	{
+		cout << "Validate missed a broken tree.\n";
+		return 1;
+	}
+	size_t operations = 0;
+	for (size_t round = 0; round < rounds; round++)
+	{
+		//every round has its own seed, so a failure replays alone with 1 round
+		uint64_t roundSeed = seed + round;
+		mt19937_64 generator(roundSeed);
+		//mostly short sequences, which hit the cases of small trees over and over, and now and then a long one
+		size_t steps = generator() % 32 == 0 ? 50000 : 1 + (size_t)(generator() % 2000);
+		vector<uint8_t> data(steps * OperationBytes);
+		for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)generator();
+		if (!Replay(data.data(), data.size()))
+		{
+			printf("round %zu failed, replay it with: TreeFuzzZone 1 %llu\n", round, (unsigned long long)roundSeed);
+			return 1;
+		}
+		operations += steps;
+	}
+	printf("%zu rounds, %zu operations, seed %llu: the tree matched std::set and validated throughout.\n",
+		rounds, operations, (unsigned long long)seed);
+	return 0;
+}
+#endif
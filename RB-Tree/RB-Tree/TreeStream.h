@@ -0,0 +1,442 @@
+/*
+Tree Stream
+streaming serialization and write ahead log for red black trees
+released under GNU GPL licence
+*/
+#ifndef TREE_STREAM_H
+#define TREE_STREAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include "RedBlackTree.h"
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+//variable length integers: 7 bits per byte, lowest first, the high bit set on all bytes but the last
+struct VarInt
+{
+	static void Put(vector<unsigned char>& out, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back((unsigned char)(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back((unsigned char)value);
+	}
+	static bool Get(const unsigned char*& data, const unsigned char* end, uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64 && data != end; shift += 7)
+		{
+			unsigned char byte = *data++;
+			value |= (uint64_t)(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) return true;
+		}
+		return false;
+	}
+	static bool Read(FILE* file, uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			int byte = getc(file);
+			if (byte == EOF) return false;
+			value |= (uint64_t)(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) return true;
+		}
+		return false;
+	}
+	//small differences of either sign become small numbers
+	static uint64_t ZigZag(uint64_t difference)
+	{
+		return (difference << 1) ^ (uint64_t)(-(int64_t)(difference >> 63));
+	}
+	static uint64_t UnZigZag(uint64_t value)
+	{
+		return (value >> 1) ^ (uint64_t)(-(int64_t)(value & 1));
+	}
+};
+
+//how a value is written after the one before it - in a sorted stream neighbours are close, so only the difference is kept
+//other trivially copyable values are written as they are
+template <class T, class Enable = void> struct StreamCodec
+{
+	static_assert(is_trivially_copyable<T>::value, "streams hold integers, strings or trivially copyable values");
+	static const unsigned char Id = 1;
+
+	static void Encode(const T&, const T& value, vector<unsigned char>& out)
+	{
+		const unsigned char* bytes = (const unsigned char*)&value;
+		out.insert(out.end(), bytes, bytes + sizeof(T));
+	}
+	static bool Decode(const T&, const unsigned char*& data, const unsigned char* end, T& value)
+	{
+		if ((size_t)(end - data) < sizeof(T)) return false;
+		memcpy(&value, data, sizeof(T));
+		data += sizeof(T);
+		return true;
+	}
+};
+//integers as the zigzag encoded difference to the previous one
+template <class T> struct StreamCodec<T, typename enable_if<is_integral<T>::value>::type>
+{
+	static const unsigned char Id = 2;
+
+	static void Encode(const T& previous, const T& value, vector<unsigned char>& out)
+	{
+		VarInt::Put(out, VarInt::ZigZag((uint64_t)value - (uint64_t)previous));
+	}
+	static bool Decode(const T& previous, const unsigned char*& data, const unsigned char* end, T& value)
+	{
+		uint64_t difference;
+		if (!VarInt::Get(data, end, difference)) return false;
+		value = (T)((uint64_t)previous + VarInt::UnZigZag(difference));
+		return true;
+	}
+};
+//strings by front coding: the length of the prefix shared with the previous one, then the rest
+template <> struct StreamCodec<string>
+{
+	static const unsigned char Id = 3;
+
+	static void Encode(const string& previous, const string& value, vector<unsigned char>& out)
+	{
+		size_t shared = 0;
+		while (shared < previous.size() && shared < value.size() && previous[shared] == value[shared]) shared++;
+		VarInt::Put(out, shared);
+		VarInt::Put(out, value.size() - shared);
+		out.insert(out.end(), value.begin() + shared, value.end());
+	}
+	static bool Decode(const string& previous, const unsigned char*& data, const unsigned char* end, string& value)
+	{
+		uint64_t shared, rest;
+		if (!VarInt::Get(data, end, shared) || !VarInt::Get(data, end, rest)) return false;
+		if (shared > previous.size() || rest > (uint64_t)(end - data)) return false;
+		value.assign(previous, 0, (size_t)shared);
+		value.append((const char*)data, (size_t)rest);
+		data += rest;
+		return true;
+	}
+};
+
+//a stream is a header and chunks, each chunk the number of its values, its length in bytes and the encoded values
+//a chunk of no values ends the stream, so a stream cut short is never taken for a whole one
+struct TreeStreamFormat
+{
+	static const unsigned char Version = 1;
+	//a corrupt length must not make the loader allocate without bound
+	static const uint64_t MaxChunkBytes = (uint64_t)1 << 30;
+
+	static void Magic(unsigned char* magic)
+	{
+		memcpy(magic, "RBTSTRM", 7);
+	}
+	template <class T> static bool WriteHeader(FILE* file)
+	{
+		vector<unsigned char> header(7);
+		Magic(header.data());
+		header.push_back((unsigned char)Version);
+		header.push_back((unsigned char)StreamCodec<T>::Id);
+		VarInt::Put(header, sizeof(T));
+		return fwrite(header.data(), 1, header.size(), file) == header.size();
+	}
+	template <class T> static bool ReadHeader(FILE* file)
+	{
+		unsigned char header[9], magic[7];
+		Magic(magic);
+		uint64_t size;
+		if (fread(header, 1, 9, file) != 9 || !VarInt::Read(file, size)) return false;
+		return memcmp(header, magic, 7) == 0 && header[7] == Version && header[8] == StreamCodec<T>::Id && size == sizeof(T);
+	}
+};
+
+//writes a tree as a stream in order, a chunk at a time
+//between two calls of Step the tree may change: the next chunk starts after the last value written,
+//so the result is sorted but fuzzy - changes behind that point are the write ahead log's to replay
+template <class T> class TreeStreamWriter
+{
+private:
+	typedef StreamCodec<T> Codec;
+	//values per chunk when a tree is written at once
+	static const size_t ChunkValues = 4096;
+
+	FILE* file;
+	T previous;
+	bool started;
+	bool done;
+	bool failed;
+	vector<unsigned char> buffer;
+
+	TreeStreamWriter(const TreeStreamWriter&) = delete;
+	TreeStreamWriter& operator=(const TreeStreamWriter&) = delete;
+
+	bool WriteChunk(uint64_t count)
+	{
+		vector<unsigned char> prefix;
+		VarInt::Put(prefix, count);
+		VarInt::Put(prefix, this->buffer.size());
+		bool written = fwrite(prefix.data(), 1, prefix.size(), this->file) == prefix.size()
+			&& (this->buffer.empty() || fwrite(this->buffer.data(), 1, this->buffer.size(), this->file) == this->buffer.size());
+		this->buffer.clear();
+		return written;
+	}
+public:
+	TreeStreamWriter() : file(NULL), previous(), started(false), done(false), failed(false)
+	{
+	}
+	~TreeStreamWriter()
+	{
+		if (this->file != NULL) fclose(this->file);
+	}
+
+	bool Open(const char* path)
+	{
+		if (this->file != NULL) fclose(this->file);
+		this->previous = T();
+		this->started = false;
+		this->done = false;
+		this->file = fopen(path, "wb");
+		this->failed = this->file == NULL || !TreeStreamFormat::WriteHeader<T>(this->file);
+		return !this->failed;
+	}
+	//writes up to the given number of values following the last one written, false once anything failed
+	template <class Tree> bool Step(Tree& tree, size_t values)
+	{
+		if (this->failed || this->file == NULL) return false;
+		typename Tree::Iterator it = this->started ? tree.upper_bound(this->previous) : tree.begin();
+		uint64_t count = 0;
+		for (; count < values && it != tree.end(); ++it, count++)
+		{
+			Codec::Encode(this->previous, *it, this->buffer);
+			this->previous = *it;
+			this->started = true;
+		}
+		this->done = it == tree.end();
+		if (count > 0 && !this->WriteChunk(count)) this->failed = true;
+		return !this->failed;
+	}
+	//whether the last step reached the end of the tree
+	bool IsDone() const
+	{
+		return this->done;
+	}
+	//ends the stream and closes the file, false if any of it could not be written
+	bool Finish()
+	{
+		if (this->file == NULL) return false;
+		if (!this->failed && !this->WriteChunk(0)) this->failed = true;
+		if (fclose(this->file) != 0) this->failed = true;
+		this->file = NULL;
+		return !this->failed;
+	}
+	//the whole tree in one go, while nothing else changes it
+	template <class Tree> bool Write(Tree& tree, const char* path)
+	{
+		if (!this->Open(path)) return false;
+		while (!this->done && this->Step(tree, ChunkValues))
+		{
+		}
+		return this->Finish();
+	}
+};
+
+//reads a stream back chunk by chunk, each one appended in O(k + log n) - see RedBlackTree::AppendSorted
+//replaces the contents of the tree, false if the stream is missing, of other values or cut short
+//on failure the tree keeps the values of the chunks read until then
+template <class T> class TreeStreamReader
+{
+private:
+	typedef StreamCodec<T> Codec;
+public:
+	template <class Tree> static bool Load(Tree& tree, const char* path)
+	{
+		FILE* file = fopen(path, "rb");
+		if (file == NULL) return false;
+		tree.ReleaseAll();
+		bool loaded = TreeStreamFormat::ReadHeader<T>(file);
+		vector<unsigned char> buffer;
+		vector<T> values;
+		T previous = T();
+		while (loaded)
+		{
+			uint64_t count, bytes;
+			if (!VarInt::Read(file, count) || !VarInt::Read(file, bytes) || bytes > TreeStreamFormat::MaxChunkBytes)
+			{
+				loaded = false;
+				break;
+			}
+			if (count == 0) break;
+			//every value takes at least a byte
+			if (bytes == 0)
+			{
+				loaded = false;
+				break;
+			}
+			buffer.resize((size_t)bytes);
+			if (fread(buffer.data(), 1, buffer.size(), file) != buffer.size())
+			{
+				loaded = false;
+				break;
+			}
+			const unsigned char* data = buffer.data();
+			const unsigned char* end = data + buffer.size();
+			values.clear();
+			for (uint64_t i = 0; i < count && loaded; i++)
+			{
+				T value;
+				loaded = Codec::Decode(previous, data, end, value);
+				if (!loaded) break;
+				values.push_back(value);
+				previous = value;
+			}
+			if (loaded) tree.AppendSorted(values.begin(), values.end());
+		}
+		fclose(file);
+		return loaded;
+	}
+};
+
+//a log of changes to replay after the last checkpoint: every record is the change, the value and a checksum,
+//written before the change is made
+//incremental checkpoints: start a new log, write the tree with TreeStreamWriter::Step between changes and
+//drop the old log once Finish succeeds - recovery loads that stream and replays the new log over it,
+//inserting a present value and deleting a missing one change nothing, so the fuzzy stream comes out exact
+template <class T> class TreeWriteAheadLog
+{
+private:
+	typedef StreamCodec<T> Codec;
+	static const unsigned char InsertRecord = 'I';
+	static const unsigned char DeleteRecord = 'D';
+
+	FILE* file;
+	//kept between records so logging allocates nothing
+	vector<unsigned char> payload;
+	vector<unsigned char> record;
+
+	TreeWriteAheadLog(const TreeWriteAheadLog&) = delete;
+	TreeWriteAheadLog& operator=(const TreeWriteAheadLog&) = delete;
+
+	//FNV-1a, enough to tell a torn or garbled record from a whole one
+	static uint32_t Checksum(const unsigned char* data, size_t size)
+	{
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < size; i++) hash = (hash ^ data[i]) * 16777619u;
+		return hash;
+	}
+	bool Log(unsigned char operation, const T& value)
+	{
+		if (this->file == NULL) return false;
+		this->payload.clear();
+		Codec::Encode(T(), value, this->payload);
+		this->record.clear();
+		this->record.push_back(operation);
+		VarInt::Put(this->record, this->payload.size());
+		this->record.insert(this->record.end(), this->payload.begin(), this->payload.end());
+		uint32_t checksum = Checksum(this->record.data(), this->record.size());
+		for (int i = 0; i < 4; i++) this->record.push_back((unsigned char)(checksum >> (8 * i)));
+		return fwrite(this->record.data(), 1, this->record.size(), this->file) == this->record.size();
+	}
+public:
+	TreeWriteAheadLog() : file(NULL)
+	{
+	}
+	~TreeWriteAheadLog()
+	{
+		this->Close();
+	}
+
+	//records are appended to the file if it exists
+	bool Open(const char* path)
+	{
+		this->Close();
+		this->file = fopen(path, "ab");
+		return this->file != NULL;
+	}
+	void Close()
+	{
+		if (this->file != NULL) fclose(this->file);
+		this->file = NULL;
+	}
+	bool LogInsert(const T& value)
+	{
+		return this->Log(InsertRecord, value);
+	}
+	bool LogDelete(const T& value)
+	{
+		return this->Log(DeleteRecord, value);
+	}
+	//the change is logged first and made on the tree after
+	template <class Tree> bool InsertNode(Tree& tree, const T& value)
+	{
+		bool logged = this->LogInsert(value);
+		tree.InsertNode(value);
+		return logged;
+	}
+	template <class Tree> bool DeleteNode(Tree& tree, const T& value)
+	{
+		bool logged = this->LogDelete(value);
+		tree.DeleteNode(value);
+		return logged;
+	}
+	//hands the records to the operating system
+	bool Flush()
+	{
+		return this->file != NULL && fflush(this->file) == 0;
+	}
+	//and waits until they are on the disk
+	bool Sync()
+	{
+		if (!this->Flush()) return false;
+#if defined(_WIN32)
+		return _commit(_fileno(this->file)) == 0;
+#else
+		return fsync(fileno(this->file)) == 0;
+#endif
+	}
+
+	//applies the records of a log in order and returns how many, stopping at the first one torn or garbled
+	template <class Tree> static size_t Replay(Tree& tree, const char* path)
+	{
+		FILE* file = fopen(path, "rb");
+		if (file == NULL) return 0;
+		size_t applied = 0;
+		vector<unsigned char> record;
+		for (;;)
+		{
+			int operation = getc(file);
+			uint64_t size;
+			if (operation == EOF || !VarInt::Read(file, size) || size > TreeStreamFormat::MaxChunkBytes) break;
+			record.clear();
+			record.push_back((unsigned char)operation);
+			VarInt::Put(record, size);
+			size_t header = record.size();
+			record.resize(header + (size_t)size + 4);
+			if (fread(record.data() + header, 1, (size_t)size + 4, file) != (size_t)size + 4) break;
+			const unsigned char* stored = record.data() + header + (size_t)size;
+			uint32_t checksum = (uint32_t)stored[0] | ((uint32_t)stored[1] << 8) | ((uint32_t)stored[2] << 16) | ((uint32_t)stored[3] << 24);
+			if (checksum != Checksum(record.data(), header + (size_t)size)) break;
+			const unsigned char* data = record.data() + header;
+			T value;
+			if (!Codec::Decode(T(), data, stored, value)) break;
+			if (operation == InsertRecord) tree.InsertNode(value);
+			else if (operation == DeleteRecord) tree.DeleteNode(value);
+			else break;
+			applied++;
+		}
+		fclose(file);
+		return applied;
+	}
+};
+
+#endif
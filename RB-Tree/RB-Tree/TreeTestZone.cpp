@@ -1,17 +1,19 @@
 /* TreeTestZone.cpp : 
 this short code can be used to perform various testing and console visualization of the structure
-as well as comparisons with binary search tree
+comparisons with std::set and a B-tree are in TreeCompareZone.cpp
 */
 
 #include <time.h>
+#include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <queue>
-#include "BinarySearchTree.h"
 #include "RedBlackTree.h"
 
 using namespace std;
 
-int main()
+//run with "batch" as first argument to skip the final pause, as the test target does
+int main(int argc, char **argv)
 {
 	cout << "Test Tree Zone \n-----------------\n\n";
 	RedBlackTree<int> *reb = new RedBlackTree<int>();
@@ -46,6 +48,11 @@ int main()
 
 	if (fine)
 		cout << "\n\nTest was successful.\n\n";
-	system("pause");
-	return 0;
+	if (argc < 2 || strcmp(argv[1], "batch") != 0)
+	{
+		cout << "Press Enter to continue...";
+		cin.get();
+	}
+	delete reb;
+	return fine ? 0 : 1;
 }
\ No newline at end of file
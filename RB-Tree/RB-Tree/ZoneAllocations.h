@@ -0,0 +1,78 @@
+/*
+Zone Allocations
+replacement operator new and delete that count the heap allocations of a zone
+include it in the one source file of a zone only, it defines the global operators
+released under GNU GPL licence
+*/
+#ifndef ZONE_ALLOCATIONS_H
+#define ZONE_ALLOCATIONS_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+//every heap allocation of the process is counted, relaxed so the counts stay exact when a zone runs threads
+static atomic<size_t> allocationCount(0);
+static atomic<size_t> allocationBytes(0);
+//bytes the heap blocks alive right now take, as malloc rounds them, and their high water mark since ResetHeapPeak
+static atomic<size_t> heapBytes(0);
+static atomic<size_t> heapPeakBytes(0);
+//GCC inlines the replacement delete next to allocations it takes for the library's operator new and warns of a mismatch
+#if defined(_MSC_VER)
+#define ZONE_NOINLINE __declspec(noinline)
+#else
+#define ZONE_NOINLINE __attribute__((noinline))
+#endif
+
+inline size_t HeapBlockSize(void *memory)
+{
+#if defined(_WIN32)
+	return _msize(memory);
+#elif defined(__APPLE__)
+	return malloc_size(memory);
+#else
+	return malloc_usable_size(memory);
+#endif
+}
+//the peak starts again from what is alive now, which is returned
+inline size_t ResetHeapPeak()
+{
+	size_t bytes = heapBytes.load(memory_order_relaxed);
+	heapPeakBytes.store(bytes, memory_order_relaxed);
+	return bytes;
+}
+
+void* operator new(size_t size)
+{
+	allocationCount.fetch_add(1, memory_order_relaxed);
+	allocationBytes.fetch_add(size, memory_order_relaxed);
+	void *memory = malloc(size == 0 ? 1 : size);
+	if (memory == NULL) throw bad_alloc();
+	size_t block = HeapBlockSize(memory);
+	size_t bytes = heapBytes.fetch_add(block, memory_order_relaxed) + block;
+	size_t peak = heapPeakBytes.load(memory_order_relaxed);
+	while (bytes > peak && !heapPeakBytes.compare_exchange_weak(peak, bytes, memory_order_relaxed))
+	{
+	}
+	return memory;
+}
+ZONE_NOINLINE void operator delete(void *memory) noexcept
+{
+	if (memory == NULL) return;
+	heapBytes.fetch_sub(HeapBlockSize(memory), memory_order_relaxed);
+	free(memory);
+}
+ZONE_NOINLINE void operator delete(void *memory, size_t) noexcept
+{
+	::operator delete(memory);
+}
+
+#endif